@@ -10,19 +10,26 @@ in VS_OUT {
    vec2 uv_base;
    vec2 uv_overlay;
    vec3 tint;
+   vec2 uv_tile;
+   float ao;
 } vs_in;
 
 uniform sampler2D blocksTexture;
+// 0 for the opaque layer, cutout blocks discard their holes
+uniform float alpha_cutoff;
 void main()
 {
-   vec4 color = texture(blocksTexture, vs_in.uv_base);
-   vec4 overlay = texture(blocksTexture, vs_in.uv_overlay);
+   // uv_base and uv_overlay are the tiles corners in tiles, repeated over merged faces
+   vec2 tile_size = vec2(16.0) / vec2(textureSize(blocksTexture, 0));
+   vec2 tile = fract(vs_in.uv_tile);
+   vec4 color = texture(blocksTexture, (vs_in.uv_base + tile) * tile_size);
+   vec4 overlay = texture(blocksTexture, (vs_in.uv_overlay + tile) * tile_size);
 
    gPosition = vs_in.position;
    gNormal = normalize(vs_in.normal);
    vec4 res = vec4(vs_in.tint, 1.0)*overlay.a*overlay+(1.0-overlay.a)*color; 
-   if (res.a<0.5) {
+   if (res.a<alpha_cutoff) {
       discard;
    }
-   gAlbedo = res;
+   gAlbedo = vec4(vs_in.ao * res.rgb, res.a);
 }
\ No newline at end of file
@@ -1,12 +1,21 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aUV;
-layout (location = 3) in vec2 aUVOoverlay;
-layout (location = 4) in vec3 aTint;
+// Packed vertex, see PackedVertex_t
+layout (location = 0) in uvec2 aPacked;
+// Per draw, see DrawCommand_t
+layout (location = 1) in vec3 slice_origin;
 
-uniform mat4 view_projection;
+// Per frame, see FrameUniforms_t
+layout (std140) uniform Frame
+{
+   mat4 view_projection;
+   mat4 light_space_matrices[4]; // MAX_SHADOW_CASCADES
+   float ssao_strength;
+   int shadow_cascades;
+};
+
+uniform usampler2D block_tiles;
+uniform sampler2D tint_palette;
 
 out VS_OUT {
    vec3 position;
@@ -14,14 +23,48 @@ out VS_OUT {
    vec2 uv_base;
    vec2 uv_overlay;
    vec3 tint;
+   vec2 uv_tile;
+   float ao;
 } vs_out;
 
+// TOP, FRONT, LEFT, BACK, RIGHT, BOTTOM
+const vec3 face_normals[6] = vec3[6](
+   vec3(0.0, 0.0, 1.0),
+   vec3(0.0, -1.0, 0.0),
+   vec3(-1.0, 0.0, 0.0),
+   vec3(0.0, 1.0, 0.0),
+   vec3(1.0, 0.0, 0.0),
+   vec3(0.0, 0.0, -1.0)
+);
+
+// Baked ambient occlusion levels, from fully occluded corners to open ones
+const float ao_levels[4] = float[4](0.45, 0.65, 0.85, 1.0);
+
 void main()
 {
-   gl_Position = view_projection * vec4(aPos, 1.0);
-   vs_out.position = aPos;
-   vs_out.normal = aNormal;
-   vs_out.uv_base = aUV;
-   vs_out.uv_overlay = aUVOoverlay;
-   vs_out.tint = aTint;
-}
\ No newline at end of file
+   vec3 local = vec3(aPacked.x & 31u, (aPacked.x >> 5) & 31u, (aPacked.x >> 10) & 31u);
+   uint face = (aPacked.x >> 15) & 7u;
+   uint block_id = aPacked.y & 0xFFFFu;
+   uint tint = aPacked.y >> 16;
+   uint ao = (aPacked.x >> 18) & 3u;
+
+   vec3 position = slice_origin + local;
+   gl_Position = view_projection * vec4(position, 1.0);
+   vs_out.position = position;
+   vs_out.normal = face_normals[face];
+   vs_out.ao = ao_levels[ao];
+
+   // Tiles corners, in tiles, scaled by the fragment shader
+   uvec4 tiles = texelFetch(block_tiles, ivec2(face, block_id), 0);
+   vs_out.uv_base = vec2(tiles.xy);
+   vs_out.uv_overlay = vec2(tiles.zw);
+   vs_out.tint = texelFetch(tint_palette, ivec2(tint & 255u, tint >> 8), 0).rgb;
+
+   // Repeated over merged faces by the fragment shader, v goes down the sides
+   if (face == 2u || face == 4u)
+      vs_out.uv_tile = vec2(local.y, -local.z);
+   else if (face == 1u || face == 3u)
+      vs_out.uv_tile = vec2(local.x, -local.z);
+   else
+      vs_out.uv_tile = local.xy;
+}
@@ -8,30 +8,36 @@ layout(binding=1) uniform sampler2D s_gNormal;
 layout(binding=2) uniform sampler2D s_gAlbedo;
 layout(binding=10) uniform sampler2D s_noise;
 
-uniform vec3 hemisphere_samples[64];
-uniform float ssao_strength;
-uniform mat4 projection;
+// Per frame, see FrameUniforms_t
+layout (std140) uniform Frame
+{
+    mat4 view_projection;
+    mat4 light_space_matrices[4]; // MAX_SHADOW_CASCADES
+    float ssao_strength;
+    int shadow_cascades;
+};
 
-uniform mat4 light_space_matrix;
-layout(binding=3) uniform sampler2D shadow_map;
+uniform vec3 hemisphere_samples[64];
+layout(binding=3) uniform sampler2DArray shadow_map;
 
-const vec2 noiseScale = vec2(800.0/4.0, 600.0/4.0);
 const int kernelSize = 32;
 const float radius = 2.0;
 const float bias = 0.1;
 
-float compute_shadow(vec4 fragPosLightSpace)
+// The cascades are ordered by distance, the first one covering the position
+// has the most resolution. Unshadowed past the last cascade
+float compute_shadow(vec3 position)
 {
-    // perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
-    if(projCoords.z > 1.0)
-        return 0.0;
-    float closestDepth = texture(shadow_map, projCoords.xy).r;
-    float currentDepth = projCoords.z;
-    float bias = 0.005;
-    float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
-    return shadow;
+    for (int i = 0; i < shadow_cascades; ++i)
+    {
+        vec3 projCoords = (light_space_matrices[i] * vec4(position, 1.0)).xyz * 0.5 + 0.5;
+        if (any(lessThan(projCoords, vec3(0.0))) || any(greaterThan(projCoords, vec3(1.0))))
+            continue;
+        float closestDepth = texture(shadow_map, vec3(projCoords.xy, float(i))).r;
+        float bias = 0.005;
+        return projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+    }
+    return 0.0;
 }
 
 void main()
@@ -40,38 +46,44 @@ void main()
     vec3 position = texture(s_gPosition, TexCoords).rgb;
     vec3 normal = texture(s_gNormal, TexCoords).rgb;
     vec3 albedo = texture(s_gAlbedo, TexCoords).rgb;
-    vec3 noise = texture(s_noise, TexCoords * noiseScale).rgb;
-
-    vec3 tangent   = normalize(noise - normal * dot(noise, normal));
-    vec3 bitangent = cross(normal, tangent);
-    mat3 TBN       = mat3(tangent, bitangent, normal);
 
-    float occlusion = 0.0;
-    for(int i = 0; i < kernelSize; ++i)
+    // Ambient occlusion is baked in the albedo, SSAO only runs when enabled
+    float occlusion = 1.0;
+    if (ssao_strength > 0.0)
     {
-        // get sample position
-        vec3 samplePos = TBN * hemisphere_samples[i]; // from tangent to view-space
-        samplePos = position + samplePos * radius;
-        vec4 offset = vec4(samplePos, 1.0);
-        offset      = projection * offset;    // from view to clip-space
-        offset.xyz /= offset.w;               // perspective divide
-        offset.xyz  = offset.xyz * 0.5 + 0.5; // transform to range 0.0 - 1.0
-        float sampleDepth = texture(s_gPosition, offset.xy).z;
-        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(position.z - sampleDepth));
-        occlusion += (sampleDepth >= samplePos.z + bias ? 1.0 : 0.0) * rangeCheck;
+        // Noise tiles of 4x4 pixels
+        vec2 noiseScale = vec2(textureSize(s_gPosition, 0)) / 4.0;
+        vec3 noise = texture(s_noise, TexCoords * noiseScale).rgb;
+
+        vec3 tangent   = normalize(noise - normal * dot(noise, normal));
+        vec3 bitangent = cross(normal, tangent);
+        mat3 TBN       = mat3(tangent, bitangent, normal);
+
+        occlusion = 0.0;
+        for(int i = 0; i < kernelSize; ++i)
+        {
+            // get sample position
+            vec3 samplePos = TBN * hemisphere_samples[i]; // from tangent to view-space
+            samplePos = position + samplePos * radius;
+            vec4 offset = vec4(samplePos, 1.0);
+            offset      = view_projection * offset; // from view to clip-space
+            offset.xyz /= offset.w;               // perspective divide
+            offset.xyz  = offset.xyz * 0.5 + 0.5; // transform to range 0.0 - 1.0
+            float sampleDepth = texture(s_gPosition, offset.xy).z;
+            float rangeCheck = smoothstep(0.0, 1.0, radius / abs(position.z - sampleDepth));
+            occlusion += (sampleDepth >= samplePos.z + bias ? 1.0 : 0.0) * rangeCheck;
+        }
+        occlusion = 1.0 - (occlusion / kernelSize);
+        occlusion = 1.-ssao_strength+ssao_strength*occlusion;
     }
-    occlusion = 1.0 - (occlusion / kernelSize);
-    occlusion = 1.-ssao_strength+ssao_strength*occlusion;
 
-    vec4 FragPosLightSpace = light_space_matrix * vec4(position, 1.);
-    float shadow = compute_shadow(FragPosLightSpace);       
+    float shadow = compute_shadow(position);       
     vec3 sunDir = normalize(vec3(1.0, 0.0, -1.0));
     float ambiant = 0.4f;
     float luminosity = min(1.f, ambiant+max(0.f, -(1.-shadow)*dot(sunDir, normal)));
 
     
-    outColor = vec4(luminosity*albedo, 1.0);
-    // outColor = vec4(occlusion*luminosity*albedo, 1.0);
+    outColor = vec4(occlusion*luminosity*albedo, 1.0);
     // outColor = vec4(vec3(occlusion), 1.0);
     // FragColor = vec4(TexCoords, 0.0, 1.0);
 }  
\ No newline at end of file
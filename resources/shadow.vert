@@ -1,14 +1,22 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aUV;
-layout (location = 3) in vec2 aUVOoverlay;
-layout (location = 4) in vec3 aTint;
+layout (location = 0) in uvec2 aPacked;
+// Per draw, see DrawCommand_t
+layout (location = 1) in vec3 slice_origin;
 
-uniform mat4 light_space_matrix;
+// Per frame, see FrameUniforms_t
+layout (std140) uniform Frame
+{
+    mat4 view_projection;
+    mat4 light_space_matrices[4]; // MAX_SHADOW_CASCADES
+    float ssao_strength;
+    int shadow_cascades;
+};
+
+uniform int cascade;
 
 void main()
 {
-    gl_Position = light_space_matrix * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    vec3 local = vec3(aPacked.x & 31u, (aPacked.x >> 5) & 31u, (aPacked.x >> 10) & 31u);
+    gl_Position = light_space_matrices[cascade] * vec4(slice_origin + local, 1.0);
+}
@@ -0,0 +1,29 @@
+#version 330 core
+
+out vec4 outColor;
+
+in VS_OUT {
+   vec3 position;
+   vec3 normal;
+   vec2 uv_base;
+   vec2 uv_overlay;
+   vec3 tint;
+   vec2 uv_tile;
+   float ao;
+} vs_in;
+
+uniform sampler2D blocksTexture;
+
+// Forward lit after the deferred pass, with its sun but without shadows
+void main()
+{
+   vec2 tile_size = vec2(16.0) / vec2(textureSize(blocksTexture, 0));
+   vec2 tile = fract(vs_in.uv_tile);
+   vec4 color = texture(blocksTexture, (vs_in.uv_base + tile) * tile_size);
+   vec4 overlay = texture(blocksTexture, (vs_in.uv_overlay + tile) * tile_size);
+   vec4 res = vec4(vs_in.tint, 1.0)*overlay.a*overlay+(1.0-overlay.a)*color;
+
+   vec3 sunDir = normalize(vec3(1.0, 0.0, -1.0));
+   float luminosity = min(1.0, 0.4 + max(0.0, -dot(sunDir, vs_in.normal)));
+   outColor = vec4(luminosity * vs_in.ao * res.rgb, res.a);
+}
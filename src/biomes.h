@@ -0,0 +1,135 @@
+#ifndef BIOMES_H
+#define BIOMES_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include "blocks.h"
+#include "generation.h"
+
+// Biomes are picked from two climate noises (temperature, humidity) sampled on
+// a coarse grid every BIOME_GRID_STEP blocks and cached per chunk. Columns then
+// bilinearly blend the biome weights of the 4 surrounding grid points, so the
+// cost per chunk is fixed whatever the number of biomes.
+
+#define BIOME_GRID_STEP 4
+#define BIOME_GRID_SIZE (16 / BIOME_GRID_STEP + 1)
+#define BIOME_CLIMATE_FREQUENCY 0.003f
+#define BIOME_CLIMATE_SPREAD 0.3f
+// Biome height scales are applied around this height
+#define BIOME_HEIGHT_PIVOT 32.f
+
+enum BiomeId
+{
+    BIOME_PLAINS,
+    BIOME_FOREST,
+    BIOME_DESERT,
+    BIOME_MOUNTAINS,
+    BIOME_TUNDRA,
+    BIOME_COUNT
+};
+
+typedef struct Biome
+{
+    const char *name;
+    float temperature;
+    float humidity;
+    BlockId_t surface_block;
+    BlockId_t filler_block;
+    float height_offset;
+    float height_scale;
+    float tree_density; // Expected trees per chunk
+    BlockId_t tree_soil; // Block trees grow on, air for none
+    glm::vec3 tint;
+} Biome_t;
+
+// clang-format off
+static const Biome_t biomes[BIOME_COUNT] = {
+    // name, temperature, humidity, surface, filler, height offset, height scale, tree density, tree soil, tint
+    {"plains",     0.2f,  0.f,  3, 2,  0.f, 0.6f, 0.4f, 3, {124.f / 255.f, 189.f / 255.f, 107.f / 255.f}},
+    {"forest",     0.1f,  0.5f, 3, 2,  2.f, 1.f,  5.f,  3, { 89.f / 255.f, 174.f / 255.f,  48.f / 255.f}},
+    {"desert",     0.6f, -0.5f, 7, 7, -2.f, 0.4f, 0.f,  0, {191.f / 255.f, 183.f / 255.f,  85.f / 255.f}},
+    {"mountains", -0.2f,  0.f,  1, 1,  8.f, 1.8f, 0.3f, 1, {138.f / 255.f, 182.f / 255.f, 123.f / 255.f}},
+    {"tundra",    -0.6f,  0.f,  8, 2,  0.f, 0.8f, 0.1f, 8, {128.f / 255.f, 180.f / 255.f, 151.f / 255.f}},
+};
+// clang-format on
+
+typedef struct BiomeMap
+{
+    float weights[BIOME_GRID_SIZE * BIOME_GRID_SIZE][BIOME_COUNT];
+} BiomeMap_t;
+
+typedef struct BiomeColumn
+{
+    BiomeId biome; // Dominant biome, drives the surface blocks
+    float height_offset;
+    float height_scale;
+    glm::vec3 tint;
+} BiomeColumn_t;
+
+void compute_biome_weights(float weights[BIOME_COUNT], float block_x, float block_y)
+{
+    const float temperature = stb_perlin_noise3_seed(BIOME_CLIMATE_FREQUENCY * block_x, BIOME_CLIMATE_FREQUENCY * block_y, 0.f, 0, 0, 0, 101);
+    const float humidity = stb_perlin_noise3_seed(BIOME_CLIMATE_FREQUENCY * block_x, BIOME_CLIMATE_FREQUENCY * block_y, 0.f, 0, 0, 0, 102);
+    float total = 0.f;
+    for (size_t biome = 0; biome < BIOME_COUNT; biome++)
+    {
+        const float dt = temperature - biomes[biome].temperature;
+        const float dh = humidity - biomes[biome].humidity;
+        weights[biome] = expf(-(dt * dt + dh * dh) / (2.f * BIOME_CLIMATE_SPREAD * BIOME_CLIMATE_SPREAD));
+        total += weights[biome];
+    }
+    for (size_t biome = 0; biome < BIOME_COUNT; biome++)
+    {
+        weights[biome] = total > 0.f ? weights[biome] / total : (biome == BIOME_PLAINS ? 1.f : 0.f);
+    }
+}
+
+// Grid points lie on multiples of BIOME_GRID_STEP, edges are shared with neighbor chunks
+void compute_biome_map(BiomeMap_t *map, int64_t chunk_x, int64_t chunk_y)
+{
+    for (int64_t j = 0; j < BIOME_GRID_SIZE; j++)
+    {
+        for (int64_t i = 0; i < BIOME_GRID_SIZE; i++)
+        {
+            compute_biome_weights(map->weights[i + BIOME_GRID_SIZE * j], chunk_x + BIOME_GRID_STEP * i, chunk_y + BIOME_GRID_STEP * j);
+        }
+    }
+}
+
+BiomeColumn_t sample_biome_column(const BiomeMap_t *map, uint8_t x, uint8_t y)
+{
+    const size_t i = x / BIOME_GRID_STEP;
+    const size_t j = y / BIOME_GRID_STEP;
+    const float fx = (float)(x % BIOME_GRID_STEP) / BIOME_GRID_STEP;
+    const float fy = (float)(y % BIOME_GRID_STEP) / BIOME_GRID_STEP;
+    const float *w00 = map->weights[i + BIOME_GRID_SIZE * j];
+    const float *w10 = map->weights[i + 1 + BIOME_GRID_SIZE * j];
+    const float *w01 = map->weights[i + BIOME_GRID_SIZE * (j + 1)];
+    const float *w11 = map->weights[i + 1 + BIOME_GRID_SIZE * (j + 1)];
+
+    BiomeColumn_t column = {BIOME_PLAINS, 0.f, 0.f, glm::vec3(0.f)};
+    float best_weight = -1.f;
+    for (size_t biome = 0; biome < BIOME_COUNT; biome++)
+    {
+        const float weight = (1.f - fy) * ((1.f - fx) * w00[biome] + fx * w10[biome]) +
+                             fy * ((1.f - fx) * w01[biome] + fx * w11[biome]);
+        if (weight > best_weight)
+        {
+            best_weight = weight;
+            column.biome = (BiomeId)biome;
+        }
+        column.height_offset += weight * biomes[biome].height_offset;
+        column.height_scale += weight * biomes[biome].height_scale;
+        column.tint += weight * biomes[biome].tint;
+    }
+    // Quantized so that slices palettes only get a handful of tinted variants
+    column.tint = glm::floor(column.tint * 32.f + 0.5f) / 32.f;
+    return column;
+}
+
+float biome_height(const BiomeColumn_t *column, float base_height)
+{
+    return BIOME_HEIGHT_PIVOT + column->height_offset + column->height_scale * (base_height - BIOME_HEIGHT_PIVOT);
+}
+
+#endif
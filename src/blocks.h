@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <array>
+#include <vector>
 
 typedef uint32_t BlockId_t;
 #define BLOCKID_AIR \
@@ -22,7 +23,72 @@ std::unordered_map<BlockId_t, std::array<std::pair<std::pair<int, int>, std::pai
     // Oak log
     {5, {std::make_pair(std::make_pair(6, 18), std::make_pair(0, 0)), std::make_pair(std::make_pair(5, 18), std::make_pair(0, 0)), std::make_pair(std::make_pair(5, 18), std::make_pair(0, 0)), std::make_pair(std::make_pair(5, 18), std::make_pair(0, 0)), std::make_pair(std::make_pair(5, 18), std::make_pair(0, 0)), std::make_pair(std::make_pair(6, 18), std::make_pair(0, 0))}},
     // Oak leaves
-    {6, {std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18))}}
+    {6, {std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18)), std::make_pair(std::make_pair(0, 0), std::make_pair(4, 18))}},
+    // Sand
+    {7, {std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0)), std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0)), std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0)), std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0)), std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0)), std::make_pair(std::make_pair(16, 23), std::make_pair(0, 0))}},
+    // Snow
+    {8, {std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0)), std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0)), std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0)), std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0)), std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0)), std::make_pair(std::make_pair(17, 25), std::make_pair(0, 0))}},
+    // Ice
+    {9, {std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0)), std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0)), std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0)), std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0)), std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0)), std::make_pair(std::make_pair(28, 1), std::make_pair(0, 0))}}
 };
 
+// How blocks are drawn: opaque blocks hide what is behind them, cutout blocks
+// have holes (alpha tested), translucent blocks are blended over the rest
+enum RenderLayer
+{
+    LAYER_OPAQUE,
+    LAYER_CUTOUT,
+    LAYER_TRANSLUCENT,
+    LAYERS_COUNT
+};
+
+// Blocks missing are opaque
+std::unordered_map<BlockId_t, RenderLayer> blocks_layers{
+    {6, LAYER_CUTOUT},      // Oak leaves
+    {9, LAYER_TRANSLUCENT}, // Ice
+};
+
+// Flattened blocks_layers, meshers look up every block
+RenderLayer block_layer(BlockId_t block_id)
+{
+    static const std::vector<RenderLayer> layers = []()
+    {
+        std::vector<RenderLayer> layers;
+        for (const auto &block : blocks_uvs)
+        {
+            if (block.first >= layers.size())
+                layers.resize(block.first + 1, LAYER_OPAQUE);
+        }
+        for (const auto &block : blocks_layers)
+        {
+            if (block.first < layers.size())
+                layers[block.first] = block.second;
+        }
+        return layers;
+    }();
+    return block_id < layers.size() ? layers[block_id] : LAYER_OPAQUE;
+}
+
+// Tinted blocks have a tint mask on at least one face. Flattened once, the
+// generation workers call it concurrently
+bool block_is_tinted(BlockId_t block_id)
+{
+    static const std::vector<bool> tinted = []()
+    {
+        std::vector<bool> tinted;
+        for (const auto &block : blocks_uvs)
+        {
+            if (block.first >= tinted.size())
+                tinted.resize(block.first + 1, false);
+            for (size_t face = 0; face < 6; face++)
+            {
+                if (block.second[face].second != std::make_pair(0, 0))
+                    tinted[block.first] = true;
+            }
+        }
+        return tinted;
+    }();
+    return block_id < tinted.size() && tinted[block_id];
+}
+
 #endif
\ No newline at end of file
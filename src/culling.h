@@ -0,0 +1,274 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include "types.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+// Clip planes of view_projection, from the sums and differences of its rows
+Frustum_t frustum_from_matrix(const glm::mat4 &view_projection)
+{
+    const glm::mat4 &m = view_projection;
+    const glm::vec4 w = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+    Frustum_t frustum;
+    for (int32_t axis = 0; axis < 3; axis++)
+    {
+        const glm::vec4 row = glm::vec4(m[0][axis], m[1][axis], m[2][axis], m[3][axis]);
+        frustum.planes[2 * axis] = w + row;
+        frustum.planes[2 * axis + 1] = w - row;
+    }
+    return frustum;
+}
+
+void clear_boxes(BoxList_t *boxes)
+{
+    boxes->min_x.clear();
+    boxes->min_y.clear();
+    boxes->min_z.clear();
+    boxes->max_x.clear();
+    boxes->max_y.clear();
+    boxes->max_z.clear();
+}
+
+void add_box(BoxList_t *boxes, const glm::vec3 &min, const glm::vec3 &max)
+{
+    boxes->min_x.push_back(min.x);
+    boxes->min_y.push_back(min.y);
+    boxes->min_z.push_back(min.z);
+    boxes->max_x.push_back(max.x);
+    boxes->max_y.push_back(max.y);
+    boxes->max_z.push_back(max.z);
+}
+
+// A box is culled when its corner farthest along the normal of a plane is
+// outside of it. Boxes crossing the frustum edges may be kept
+bool box_in_frustum(const Frustum_t *frustum, const glm::vec3 &min, const glm::vec3 &max)
+{
+    for (const glm::vec4 &plane : frustum->planes)
+    {
+        const float x = plane.x > 0.f ? max.x : min.x;
+        const float y = plane.y > 0.f ? max.y : min.y;
+        const float z = plane.z > 0.f ? max.z : min.z;
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.f)
+            return false;
+    }
+    return true;
+}
+
+// Sets boxes->visible for every box, returns how many are visible
+size_t cull_boxes(const Frustum_t *frustum, BoxList_t *boxes)
+{
+    const size_t count = boxes->min_x.size();
+    boxes->visible.resize(count);
+    size_t first = 0;
+#ifdef CULLING_SSE
+    // Four boxes at a time, the farthest corner only depends on the plane
+    __m128 planes[6][4];
+    for (int32_t i = 0; i < 6; i++)
+    {
+        for (int32_t j = 0; j < 4; j++)
+        {
+            planes[i][j] = _mm_set1_ps(frustum->planes[i][j]);
+        }
+    }
+    for (; first + 4 <= count; first += 4)
+    {
+        __m128 outside = _mm_setzero_ps();
+        for (int32_t i = 0; i < 6; i++)
+        {
+            const glm::vec4 &plane = frustum->planes[i];
+            const __m128 x = _mm_loadu_ps(plane.x > 0.f ? &boxes->max_x[first] : &boxes->min_x[first]);
+            const __m128 y = _mm_loadu_ps(plane.y > 0.f ? &boxes->max_y[first] : &boxes->min_y[first]);
+            const __m128 z = _mm_loadu_ps(plane.z > 0.f ? &boxes->max_z[first] : &boxes->min_z[first]);
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[i][0], x), _mm_mul_ps(planes[i][1], y)),
+                                               _mm_add_ps(_mm_mul_ps(planes[i][2], z), planes[i][3]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+        }
+        const int mask = _mm_movemask_ps(outside);
+        for (int32_t i = 0; i < 4; i++)
+        {
+            boxes->visible[first + i] = (mask >> i & 1) == 0;
+        }
+    }
+#endif
+    for (; first < count; first++)
+    {
+        const glm::vec3 min = glm::vec3(boxes->min_x[first], boxes->min_y[first], boxes->min_z[first]);
+        const glm::vec3 max = glm::vec3(boxes->max_x[first], boxes->max_y[first], boxes->max_z[first]);
+        boxes->visible[first] = box_in_frustum(frustum, min, max);
+    }
+    size_t visible = 0;
+    for (uint8_t box : boxes->visible)
+    {
+        visible += box;
+    }
+    return visible;
+}
+
+void clear_occlusion(OcclusionBuffer_t *buffer, const glm::mat4 &view_projection)
+{
+    buffer->view_projection = view_projection;
+    buffer->depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.f);
+}
+
+// Pixel coordinates and depth of point, false when it's behind the near plane
+bool project_occlusion(const OcclusionBuffer_t *buffer, const glm::vec3 &point, glm::vec3 *screen)
+{
+    const glm::vec4 clip = buffer->view_projection * glm::vec4(point, 1.f);
+    if (clip.w <= 0.f || clip.z < -clip.w)
+        return false;
+    *screen = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH, (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT, clip.z / clip.w);
+    return true;
+}
+
+// Writes the triangle depth to the pixels which centers it covers. A pixel gets
+// the farthest depth of the triangle plane over it, the triangle hides what's
+// behind that depth only
+void rasterize_triangle(OcclusionBuffer_t *buffer, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+    float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (std::abs(area) < 1e-6f)
+        return;
+    if (area < 0.f)
+    {
+        std::swap(b, c);
+        area = -area;
+    }
+    const int32_t min_x = std::max(0, (int32_t)std::floor(std::min({a.x, b.x, c.x})));
+    const int32_t max_x = std::min(OCCLUSION_WIDTH - 1, (int32_t)std::floor(std::max({a.x, b.x, c.x})));
+    const int32_t min_y = std::max(0, (int32_t)std::floor(std::min({a.y, b.y, c.y})));
+    const int32_t max_y = std::min(OCCLUSION_HEIGHT - 1, (int32_t)std::floor(std::max({a.y, b.y, c.y})));
+    if (min_x > max_x || min_y > max_y)
+        return;
+
+    // Edges as x * edge_x + y * edge_y + edge_c, positive inside
+    const glm::vec3 corners[3] = {a, b, c};
+    float edge_x[3], edge_y[3], edge_c[3];
+    for (int32_t i = 0; i < 3; i++)
+    {
+        const glm::vec3 &from = corners[i];
+        const glm::vec3 &to = corners[(i + 1) % 3];
+        edge_x[i] = from.y - to.y;
+        edge_y[i] = to.x - from.x;
+        edge_c[i] = (to.y - from.y) * from.x - (to.x - from.x) * from.y;
+    }
+    const float depth_x = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+    const float depth_y = ((b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z)) / area;
+    const float depth_c = a.z - depth_x * a.x - depth_y * a.y + 0.5f * (std::abs(depth_x) + std::abs(depth_y));
+    const float max_depth = std::max({a.z, b.z, c.z});
+
+    for (int32_t y = min_y; y <= max_y; y++)
+    {
+        const float center_y = y + 0.5f;
+        float *row = &buffer->depth[y * OCCLUSION_WIDTH];
+#ifdef CULLING_SSE
+        // Four pixels at a time, the rows are a multiple of 4 wide
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        for (int32_t x = min_x & ~3; x <= max_x; x += 4)
+        {
+            const __m128 center_x = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int32_t i = 0; i < 3; i++)
+            {
+                const __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_x[i]), center_x), _mm_set1_ps(edge_y[i] * center_y + edge_c[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_setzero_ps()));
+            }
+            const __m128 depth = _mm_min_ps(_mm_set1_ps(max_depth), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depth_x), center_x), _mm_set1_ps(depth_y * center_y + depth_c)));
+            const __m128 current = _mm_loadu_ps(row + x);
+            const __m128 nearest = _mm_min_ps(current, depth);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+        }
+#else
+        for (int32_t x = min_x; x <= max_x; x++)
+        {
+            const float center_x = x + 0.5f;
+            bool inside = true;
+            for (int32_t i = 0; i < 3; i++)
+            {
+                inside = inside && edge_x[i] * center_x + edge_y[i] * center_y + edge_c[i] >= 0.f;
+            }
+            if (inside)
+                row[x] = std::min(row[x], std::min(max_depth, depth_x * center_x + depth_y * center_y + depth_c));
+        }
+#endif
+    }
+}
+
+// Quad between the world space corners min and max, flat along one axis.
+// Skipped when it crosses the near plane
+void rasterize_occluder(OcclusionBuffer_t *buffer, const glm::vec3 &min, const glm::vec3 &max)
+{
+    // The two axes the quad spans, the corners go around it
+    const int32_t u = min.x == max.x ? 1 : 0;
+    const int32_t v = min.z == max.z ? 1 : 2;
+    glm::vec3 screen[4];
+    for (int32_t corner = 0; corner < 4; corner++)
+    {
+        glm::vec3 point = min;
+        point[u] = corner == 1 || corner == 2 ? max[u] : min[u];
+        point[v] = corner >= 2 ? max[v] : min[v];
+        if (!project_occlusion(buffer, point, &screen[corner]))
+            return;
+    }
+    rasterize_triangle(buffer, screen[0], screen[1], screen[2]);
+    rasterize_triangle(buffer, screen[0], screen[2], screen[3]);
+}
+
+// Whether every pixel around the box holds a depth closer than the box. The
+// box covers one more pixel on each side since the occluders cover the pixels
+// by their centers. Boxes crossing the near plane are never occluded
+bool box_occluded(const OcclusionBuffer_t *buffer, const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 low = glm::vec3(INFINITY);
+    glm::vec3 high = glm::vec3(-INFINITY);
+    for (int32_t corner = 0; corner < 8; corner++)
+    {
+        const glm::vec3 point = glm::vec3(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z);
+        glm::vec3 screen;
+        if (!project_occlusion(buffer, point, &screen))
+            return false;
+        low = glm::min(low, screen);
+        high = glm::max(high, screen);
+    }
+    const int32_t min_x = std::max(0, (int32_t)std::floor(low.x) - 1);
+    const int32_t max_x = std::min(OCCLUSION_WIDTH - 1, (int32_t)std::floor(high.x) + 1);
+    const int32_t min_y = std::max(0, (int32_t)std::floor(low.y) - 1);
+    const int32_t max_y = std::min(OCCLUSION_HEIGHT - 1, (int32_t)std::floor(high.y) + 1);
+    if (min_x > max_x || min_y > max_y)
+        return false;
+    for (int32_t y = min_y; y <= max_y; y++)
+    {
+        const float *row = &buffer->depth[y * OCCLUSION_WIDTH];
+#ifdef CULLING_SSE
+        const __m128 nearest = _mm_set1_ps(low.z);
+        const __m128i first = _mm_set1_epi32(min_x);
+        const __m128i last = _mm_set1_epi32(max_x);
+        for (int32_t x = min_x & ~3; x <= max_x; x += 4)
+        {
+            // Pixels of the group out of the box don't count
+            const __m128i columns = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+            const __m128i in_box = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(columns, first), _mm_cmpgt_epi32(columns, last)), _mm_set1_epi32(-1));
+            const __m128 behind = _mm_cmpge_ps(_mm_loadu_ps(row + x), nearest);
+            if (_mm_movemask_ps(_mm_and_ps(behind, _mm_castsi128_ps(in_box))) != 0)
+                return false;
+        }
+#else
+        for (int32_t x = min_x; x <= max_x; x++)
+        {
+            if (row[x] >= low.z)
+                return false;
+        }
+#endif
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef DECORATION_H
+#define DECORATION_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+#include <tuple>
+#include <mutex>
+#include "types.h"
+#include "world.h"
+
+// Decoration runs per slice once its terrain is carved. Features are placed
+// from the chunk seed only, so the result doesn't depend on the generation
+// order or thread: every slice of a column draws the same tree attempts and
+// keeps the trees rooted in it. Decoration only writes into its own slice:
+// blocks falling into other slices are published in world->pending_blocks and
+// applied by the light stage of the target slice, once all its neighbors are
+// decorated.
+//
+// Writes never depend on order either: a block only replaces blocks of lower
+// decoration priority, and terrain is never replaced.
+
+typedef SliceMap<std::vector<PendingBlock_t>> SpilledBlocks_t;
+
+#define DECORATION_TREE_ATTEMPTS 8
+
+uint8_t decoration_priority(BlockId_t block_id)
+{
+    switch (block_id)
+    {
+    case 0:
+        return 0; // AIR
+    case 6:
+        return 1; // OAK LEAVE
+    case 5:
+        return 2; // OAK LOG
+    default:
+        return 255;
+    }
+}
+
+uint64_t chunk_seed(World_t *world, int64_t chunk_x, int64_t chunk_y)
+{
+    return hash_coords(world->seed, chunk_x, chunk_y, 0);
+}
+
+void write_decoration_block(Slice_t *slice, uint8_t x, uint8_t y, uint8_t z, Block_t block)
+{
+    uint16_t *current = &slice->blocks[block_index(x, y, z)];
+    if (decoration_priority(slice->table[*current].block_id) >= decoration_priority(block.block_id))
+        return;
+    *current = find_or_add_block(slice, block);
+}
+
+// x, y, z local to slice, may be outside of it
+void place_decoration_block(Slice_t *slice, SpilledBlocks_t *spills, int64_t x, int64_t y, int64_t z, Block_t block)
+{
+    if (x >= 0 && x < 16 && y >= 0 && y < 16 && z >= 0 && z < 16)
+    {
+        write_decoration_block(slice, x, y, z, block);
+        return;
+    }
+    const SliceKey_t target = {block_to_chunk(slice->x + x), block_to_chunk(slice->y + y), block_to_chunk(slice->z + z)};
+    const uint8_t local_x = slice->x + x - 16 * target.x;
+    const uint8_t local_y = slice->y + y - 16 * target.y;
+    const uint8_t local_z = slice->z + z - 16 * target.z;
+    (*spills)[target].push_back(PendingBlock_t{local_x, local_y, local_z, block});
+}
+
+// x, y, z local to slice (may be outside of it), z is the first trunk block
+void place_tree(Slice_t *slice, SpilledBlocks_t *spills, Random_t *random, int64_t x, int64_t y, int64_t z, glm::vec3 tint)
+{
+    const uint32_t height = 4 + random_next(random) % 3;
+    const Block_t leaves = Block_t{6, tint};
+    const Block_t log = Block_t{5};
+    const int64_t top = z + height;
+    for (int64_t dz = -2; dz <= 2; dz++)
+    {
+        for (int64_t dy = -2; dy <= 2; dy++)
+        {
+            for (int64_t dx = -2; dx <= 2; dx++)
+            {
+                // Trim the corners of the canopy
+                if (std::abs(dx) == 2 && std::abs(dy) == 2 && (dz == 2 || random_next_float(random) < 0.5f))
+                    continue;
+                place_decoration_block(slice, spills, x + dx, y + dy, top + dz, leaves);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < height; i++)
+    {
+        place_decoration_block(slice, spills, x, y, z + i, log);
+    }
+}
+
+void decorate_slice(World_t *world, Slice_t *slice)
+{
+    const Chunk_t *chunk = slice->chunk;
+    SpilledBlocks_t spills;
+    Random_t random = {chunk_seed(world, chunk->x / 16, chunk->y / 16)};
+    for (size_t attempt = 0; attempt < DECORATION_TREE_ATTEMPTS; attempt++)
+    {
+        // Always draw the same amount of numbers so that attempts stay independent
+        const uint8_t x = random_next(&random) % 16;
+        const uint8_t y = random_next(&random) % 16;
+        const float roll = random_next_float(&random);
+        Random_t tree_random = {random_next(&random)};
+
+        const BiomeColumn_t column = sample_biome_column(&chunk->biomes, x, y);
+        const Biome_t *biome = &biomes[column.biome];
+        if (roll * DECORATION_TREE_ATTEMPTS >= biome->tree_density)
+            continue;
+        const int64_t height = chunk->heights[x + 16 * y] - slice->z;
+        if (height < 0 || height >= 16)
+            continue; // Rooted in another slice of the column
+        if (biome->tree_soil == BLOCKID_AIR || slice->table[slice->blocks[block_index(x, y, height)]].block_id != biome->tree_soil)
+            continue; // Trees only grow on their soil, and not over caves
+        place_tree(slice, &spills, &tree_random, x, y, height + 1, column.tint);
+    }
+
+    // Replaces what a previous generation of this slice published
+    const SliceKey_t source = slice_key(slice);
+    std::lock_guard<std::mutex> lock(world->pending_mutex);
+    for (auto &spill : spills)
+    {
+        world->pending_blocks[spill.first][source] = std::move(spill.second);
+    }
+}
+
+void apply_pending_blocks(World_t *world, Slice_t *slice)
+{
+    std::lock_guard<std::mutex> lock(world->pending_mutex);
+    auto pending = world->pending_blocks.find(slice_key(slice));
+    if (pending == world->pending_blocks.end())
+        return;
+    // In a fixed order, the palette order must not depend on the map history
+    std::vector<std::pair<SliceKey_t, const std::vector<PendingBlock_t> *>> sources;
+    for (const auto &source : pending->second)
+    {
+        sources.push_back(std::make_pair(source.first, &source.second));
+    }
+    std::sort(sources.begin(), sources.end(), [](const auto &a, const auto &b)
+              { return std::tie(a.first.x, a.first.y, a.first.z) < std::tie(b.first.x, b.first.y, b.first.z); });
+    for (const auto &source : sources)
+    {
+        for (const PendingBlock_t &block : *source.second)
+        {
+            write_decoration_block(slice, block.x, block.y, block.z, block.block);
+        }
+    }
+}
+
+// Drops the spills between slice and slices that are not loaded anymore, main thread only
+void release_pending_blocks(World_t *world, Slice_t *slice)
+{
+    const SliceKey_t key = slice_key(slice);
+    std::lock_guard<std::mutex> lock(world->pending_mutex);
+    auto pending = world->pending_blocks.find(key);
+    if (pending != world->pending_blocks.end())
+    {
+        for (auto source = pending->second.begin(); source != pending->second.end();)
+        {
+            source = world->slices.count(source->first) == 0 ? pending->second.erase(source) : std::next(source);
+        }
+        if (pending->second.empty())
+            world->pending_blocks.erase(pending);
+    }
+    for (auto target = world->pending_blocks.begin(); target != world->pending_blocks.end();)
+    {
+        if (world->slices.count(target->first) == 0)
+            target->second.erase(key);
+        target = target->second.empty() ? world->pending_blocks.erase(target) : std::next(target);
+    }
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef GENERATION_H
 #define GENERATION_H
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
@@ -15,17 +16,16 @@ typedef struct Perlin
     float *octaves_amplitudes;
 } Perlin_t;
 
-void init_perlin(Perlin_t *perlin, float octaves_frequencies[], float octaves_offsets[], float octaves_amplitudes[])
+void init_perlin(Perlin_t *perlin, size_t count, const float octaves_frequencies[], const float octaves_offsets[], const float octaves_amplitudes[])
 {
-    size_t count = sizeof(octaves_frequencies) / sizeof(float);
     perlin->octaves_count = count;
     perlin->octaves_frequencies = (float *)malloc(count * sizeof(float));
     perlin->octaves_offsets = (float *)malloc(count * sizeof(float));
     perlin->octaves_amplitudes = (float *)malloc(count * sizeof(float));
 
-    std::memcpy(perlin->octaves_frequencies, octaves_frequencies, sizeof(octaves_frequencies));
-    std::memcpy(perlin->octaves_offsets, octaves_offsets, sizeof(octaves_offsets));
-    std::memcpy(perlin->octaves_amplitudes, octaves_amplitudes, sizeof(octaves_amplitudes));
+    std::memcpy(perlin->octaves_frequencies, octaves_frequencies, count * sizeof(float));
+    std::memcpy(perlin->octaves_offsets, octaves_offsets, count * sizeof(float));
+    std::memcpy(perlin->octaves_amplitudes, octaves_amplitudes, count * sizeof(float));
 }
 
 double sample_perlin(Perlin_t *perlin, double x, double y, double z)
@@ -43,9 +43,47 @@ double sample_perlin(Perlin_t *perlin, double x, double y, double z)
     return val;
 }
 
+// Deterministic randomness: generation must not depend on chunk order or thread
+inline uint64_t hash_u64(uint64_t x)
+{
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hash_coords(uint64_t seed, int64_t x, int64_t y, int64_t z)
+{
+    return hash_u64(seed ^ hash_u64(x ^ hash_u64(y ^ hash_u64(z))));
+}
+
+// In [0, 1)
+inline float hash_float(uint64_t hash)
+{
+    return (hash >> 40) * (1.f / (1ull << 24));
+}
+
+typedef struct Random
+{
+    uint64_t state;
+} Random_t;
+
+inline uint64_t random_next(Random_t *random)
+{
+    random->state += 0x9e3779b97f4a7c15ull;
+    return hash_u64(random->state);
+}
+
+inline float random_next_float(Random_t *random)
+{
+    return hash_float(random_next(random));
+}
+
 void free_perlin(Perlin_t *perlin)
 {
     free(perlin->octaves_frequencies);
+    free(perlin->octaves_offsets);
     free(perlin->octaves_amplitudes);
 }
 
@@ -0,0 +1,69 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include "types.h"
+
+// Free list of the geometry arena, in quads. The buffer itself is managed by
+// the renderer, which grows it when an allocation fails
+
+#define GEOMETRY_ALLOCATION_FAILED UINT32_MAX
+
+// First fit, returns the first quad of the range
+uint32_t allocate_geometry(GeometryArena_t *arena, uint32_t count)
+{
+    for (size_t i = 0; i < arena->free_ranges.size(); i++)
+    {
+        GeometryRange_t *range = &arena->free_ranges[i];
+        if (range->count < count)
+            continue;
+        const uint32_t first = range->first;
+        range->first += count;
+        range->count -= count;
+        if (range->count == 0)
+            arena->free_ranges.erase(arena->free_ranges.begin() + i);
+        return first;
+    }
+    return GEOMETRY_ALLOCATION_FAILED;
+}
+
+// Merges the range with the free ranges around it
+void free_geometry(GeometryArena_t *arena, uint32_t first, uint32_t count)
+{
+    if (count == 0)
+        return;
+    auto next = std::lower_bound(arena->free_ranges.begin(), arena->free_ranges.end(), first, [](const GeometryRange_t &range, uint32_t first)
+                                 { return range.first < first; });
+    const bool merge_previous = next != arena->free_ranges.begin() && (next - 1)->first + (next - 1)->count == first;
+    const bool merge_next = next != arena->free_ranges.end() && first + count == next->first;
+    if (merge_previous && merge_next)
+    {
+        (next - 1)->count += count + next->count;
+        arena->free_ranges.erase(next);
+    }
+    else if (merge_previous)
+    {
+        (next - 1)->count += count;
+    }
+    else if (merge_next)
+    {
+        next->first = first;
+        next->count += count;
+    }
+    else
+    {
+        arena->free_ranges.insert(next, GeometryRange_t{first, count});
+    }
+}
+
+// Adds the quads from capacity to new_capacity to the free list
+void grow_geometry(GeometryArena_t *arena, uint32_t new_capacity)
+{
+    const uint32_t capacity = arena->capacity;
+    arena->capacity = new_capacity;
+    free_geometry(arena, capacity, new_capacity - capacity);
+}
+
+#endif
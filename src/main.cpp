@@ -19,9 +19,18 @@
 
 #include "blocks.h"
 #include "generation.h"
+#include "noise_graph.h"
 #include "player.h"
 #include "types.h"
 #include "world.h"
+#include "decoration.h"
+#include "storage.h"
+#include "mesher.h"
+#include "pipeline.h"
+#include "geometry.h"
+#include "culling.h"
+#include "shader.h"
+#include "shadows.h"
 
 using namespace std;
 
@@ -63,416 +72,13 @@ std::vector<unsigned int> fullscreen_rect_indices = {
 };
 // clang-format on
 
-#define LAND_GREEN                                  \
-    {                                               \
-        124.f / 255.f, 189.f / 255.f, 107.f / 255.f \
-    }
-
 // TOP, FRONT, LEFT, BACK, RIGHT, BOTTOM
 
-const int TEXTURE_BLOCKS_WIDTH = 1024;
-const int TEXTURE_BLOCKS_HEIGHT = 512;
-const float TEXTURE_TILE_WIDTH = 16.f / TEXTURE_BLOCKS_WIDTH;
-const float TEXTURE_TILE_HEIGHT = 16.f / TEXTURE_BLOCKS_HEIGHT;
-
-void init_slice(Slice_t *slice)
-{
-    slice->table = {};
-}
-
-void init_chunk(Chunk_t *chunk, Section_t *section, int64_t x, int64_t y)
-{
-    chunk->section_x = x;
-    chunk->section_y = y;
-    chunk->x = section->x * 256 + 16 * x;
-    chunk->y = section->y * 256 + 16 * y;
-    for (uint8_t slice = 0; slice < 24; slice++)
-    {
-        init_slice(&chunk->slices[slice]);
-    }
-}
-
 inline int positive_mod(int i, int n)
 {
     return (i % n + n) % n;
 }
 
-Block_t *get_block(Section_t *section, Chunk_t *chunk, Slice_t *slice, int32_t x, int32_t y, int32_t z)
-{
-    int32_t slice_x = positive_mod(x, 16);
-    int32_t slice_y = positive_mod(y, 16);
-    int32_t slice_z = positive_mod(z, 16);
-    Slice_t *concerned_slice = slice;
-    if (x < 0)
-    {
-        if (chunk->section_x <= 0)
-            return &block_air;
-        Chunk_t *concerned_chunk = section->chunks[chunk_id(chunk->section_x - 1, chunk->section_y)];
-        if (concerned_chunk == NULL)
-            return &block_air;
-        concerned_slice = &concerned_chunk->slices[slice->index];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    if (x > 15)
-    {
-        if (chunk->section_x >= 15)
-            return &block_air;
-        Chunk_t *concerned_chunk = section->chunks[chunk_id(chunk->section_x + 1, chunk->section_y)];
-        if (concerned_chunk == NULL)
-            return &block_air;
-        concerned_slice = &concerned_chunk->slices[slice->index];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    if (y < 0)
-    {
-        if (chunk->section_y <= 0)
-            return &block_air;
-        Chunk_t *concerned_chunk = section->chunks[chunk_id(chunk->section_x, chunk->section_y - 1)];
-        if (concerned_chunk == NULL)
-            return &block_air;
-        concerned_slice = &concerned_chunk->slices[slice->index];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    if (y > 15)
-    {
-        if (chunk->section_y >= 15)
-            return &block_air;
-        Chunk_t *concerned_chunk = section->chunks[chunk_id(chunk->section_x, chunk->section_y + 1)];
-        if (concerned_chunk == NULL)
-            return &block_air;
-        concerned_slice = &concerned_chunk->slices[slice->index];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    if (z < 0)
-    {
-        if (slice->index <= 0)
-            return &block_air;
-        concerned_slice = &chunk->slices[slice->index - 1];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    if (z > 15)
-    {
-        if (slice->index >= 23)
-            return &block_air;
-        concerned_slice = &chunk->slices[slice->index + 1];
-        if (concerned_slice == NULL)
-            return &block_air;
-    }
-    const size_t blocks_count = concerned_slice->table.size();
-    if (blocks_count == 0)
-    {
-        std::cout << "[ERROR] Trying to get the block id of a block within an empty chunk" << std::endl;
-        return 0;
-    }
-    else if (blocks_count == 1)
-    {
-        return &concerned_slice->table[0];
-    }
-    else
-    {
-        return &concerned_slice->table[concerned_slice->blocks[block_index(slice_x, slice_y, slice_z)]];
-    }
-}
-
-void generate_chunk(World_t *world, Chunk_t *chunk)
-{
-    for (size_t slice_index = 0; slice_index < 24; slice_index++)
-    {
-        Slice_t *slice = &chunk->slices[slice_index];
-        slice->table.push_back(block_air);              // AIR
-        slice->table.push_back(Block_t{1});             // STONE
-        slice->table.push_back(Block_t{2});             // DIRT
-        slice->table.push_back(Block_t{3, LAND_GREEN}); // GRASS
-        slice->table.push_back(Block_t{4});             // BEDROCK
-        slice->table.push_back(Block_t{5});             // OAK LOG
-        slice->table.push_back(Block_t{6, LAND_GREEN}); // OAK LEAVE
-        slice->index = slice_index;
-        slice->z = 16 * slice_index;
-        for (size_t x = 0; x < 16; x++)
-        {
-            double block_x = x + chunk->x;
-            for (size_t y = 0; y < 16; y++)
-            {
-                double block_y = y + chunk->y;
-                float scale = 0.1f;
-                uint8_t height = sample_perlin(&world->heightmap, block_x, block_y, 0.f);
-                // uint8_t height = 50.f +
-                //                  stb_perlin_noise3(scale * block_x, scale * block_y, 0.f, 0, 0, 0) * 5.f +
-                //                  stb_perlin_noise3(0.2f * scale * block_x, 0.2f * scale * block_y, 0.f, 0, 0, 0) * 10.f;
-                uint8_t dirt_height = (0.5f + 0.5f * stb_perlin_noise3(scale * block_x, scale * block_y, 0.f, 0, 0, 0)) * 5.f;
-                for (size_t z = 0; z < 16; z++)
-                {
-                    int block_z = z + slice->z;
-                    const float r = (float)rand() / (float)RAND_MAX;
-                    bool bedrock = block_z == 0 || (block_z / 3.f) * (block_z / 3.f) < r;
-                    if (bedrock)
-                    {
-                        slice->blocks[block_index(x, y, z)] = 4;
-                        continue;
-                    }
-                    float scale = 0.05f;
-                    float cave = stb_perlin_noise3(scale * block_x, scale * block_y, scale * block_z, 0, 0, 0);
-                    bool air = block_z > height || cave >= 0.4f;
-                    if (air)
-                    {
-                        slice->blocks[block_index(x, y, z)] = 0;
-                    }
-                    else
-                    {
-                        bool top_layer = block_z == height;
-                        bool dirt_zone = (height - block_z) <= dirt_height;
-                        slice->blocks[block_index(x, y, z)] = top_layer ? 3 : (dirt_zone ? 2 : 1);
-                    }
-                }
-            }
-        }
-    }
-}
-
-void fill_rect(World_t *world, glm::vec3 min, glm::vec3 max, int16_t val)
-{
-    for (int64_t x = min.x; x <= max.x; x++)
-    {
-        for (int64_t y = min.y; y <= max.y; y++)
-        {
-            for (int64_t z = min.z; z <= max.z; z++)
-            {
-                uint16_t *block = get_global_block(world, x, y, z);
-                if (block != NULL)
-                    *block = val;
-            }
-        }
-    }
-}
-
-void spawn_tree(World_t *world, glm::vec3 position, uint32_t height)
-{
-    glm::vec3 top = position + glm::vec3(0, 0, height);
-    fill_rect(world, top - glm::vec3(2, 2, 2), top + glm::vec3(2, 2, 2), 6);
-    for (size_t i = 0; i < height; i++)
-    {
-        uint16_t *block = get_global_block(world, position.x, position.y, position.z + i);
-        if (block != NULL)
-            *block = 5; // WOOD
-    }
-}
-
-void push_indices(std::vector<unsigned int> *indices, size_t offset, float normal_direction)
-{
-    if (normal_direction > 0)
-    {
-        indices->push_back(offset + 2);
-        indices->push_back(offset + 1);
-        indices->push_back(offset + 0);
-        indices->push_back(offset + 3);
-        indices->push_back(offset + 2);
-        indices->push_back(offset + 0);
-    }
-    else
-    {
-        indices->push_back(offset + 0);
-        indices->push_back(offset + 1);
-        indices->push_back(offset + 2);
-        indices->push_back(offset + 0);
-        indices->push_back(offset + 2);
-        indices->push_back(offset + 3);
-    }
-}
-
-std::pair<float, float> get_uv_offset(BlockId_t block_id, uint8_t face, bool overlay = false)
-{
-    const std::array<std::pair<std::pair<int, int>, std::pair<int, int>>, 6> uv_offsets = blocks_uvs[block_id];
-    if (overlay)
-    {
-        return std::make_pair(16.f * uv_offsets[face].second.first / TEXTURE_BLOCKS_WIDTH, 16.f * uv_offsets[face].second.second / TEXTURE_BLOCKS_HEIGHT);
-    }
-    else
-    {
-        return std::make_pair(16.f * uv_offsets[face].first.first / TEXTURE_BLOCKS_WIDTH, 16.f * uv_offsets[face].first.second / TEXTURE_BLOCKS_HEIGHT);
-    }
-}
-
-void add_face_x(std::vector<float> *vertices, std::vector<unsigned int> *indices, int64_t x, int64_t y, int64_t z, float slice_height, float normal_direction, uint32_t base_id, glm::vec3 tint = {1., 1., 1.})
-{
-    size_t offset = vertices->size() / 13;
-
-    uint8_t face = normal_direction > 0 ? 4 : 2;
-    auto [uv_x, uv_y] = get_uv_offset(base_id, face);
-    auto [uv_ov_x, uv_ov_y] = get_uv_offset(base_id, face, true);
-    // clang-format off
-    const std::vector<float> new_vertices = {
-        (float)x, (float)y, (float)z, (float)normal_direction, 0.f, 0.f, 0.f+uv_x, TEXTURE_TILE_HEIGHT+uv_y, 0.f+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x, (float)y+1.f, (float)z, (float)normal_direction, 0.f, 0.f, TEXTURE_TILE_WIDTH+uv_x, TEXTURE_TILE_HEIGHT+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x, (float)y+1.f, (float)z+1.f, (float)normal_direction, 0.f, 0.f, TEXTURE_TILE_WIDTH+uv_x, 0.f+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x, (float)y, (float)z+1.f, (float)normal_direction, 0.f, 0.f, 0.f+uv_x, 0.f+uv_y, 0.f+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b
-    };
-    // clang-format on
-
-    vertices->reserve(vertices->size() + distance(new_vertices.begin(), new_vertices.end()));
-    vertices->insert(vertices->end(), new_vertices.begin(), new_vertices.end());
-
-    push_indices(indices, offset, -normal_direction);
-}
-
-void add_face_y(std::vector<float> *vertices, std::vector<unsigned int> *indices, int64_t x, int64_t y, int64_t z, float slice_height, float normal_direction, uint32_t base_id, glm::vec3 tint = {1., 1., 1.})
-{
-    size_t offset = vertices->size() / 13;
-
-    uint8_t face = normal_direction > 0 ? 3 : 1;
-    auto [uv_x, uv_y] = get_uv_offset(base_id, face);
-    auto [uv_ov_x, uv_ov_y] = get_uv_offset(base_id, face, true);
-
-    // clang-format off
-    // Face_id: top(0), front(1), left(2), back(3), right(4), bottom(5)
-    // const float face_id = normal_direction?0.f:1.f;
-    // const std::vector<float> new_vertices = {
-    //     (float)x, (float)y, (float)z, face_id, block_base_id, block_overlay_id, tint.r, tint.g, tint.b,
-    //     (float)x+1.f, (float)y, (float)z, face_id, block_base_id, block_overlay_id, tint.r, tint.g, tint.b,
-    //     (float)x+1.f, (float)y, (float)z+1.f, face_id, block_base_id, block_overlay_id, tint.r, tint.g, tint.b,
-    //     (float)x, (float)y, (float)z+1.f, face_id, block_base_id, block_overlay_id, tint.r, tint.g, tint.b
-    // };
-    const std::vector<float> new_vertices = {
-        (float)x, (float)y, (float)z, 0.f, (float)normal_direction, 0.f, 0.f+uv_x, TEXTURE_TILE_HEIGHT+uv_y, 0.f+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x+1.f, (float)y, (float)z, 0.f, (float)normal_direction, 0.f, TEXTURE_TILE_WIDTH+uv_x, TEXTURE_TILE_HEIGHT+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x+1.f, (float)y, (float)z+1.f, 0.f, (float)normal_direction, 0.f, TEXTURE_TILE_WIDTH+uv_x, 0.f+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x, (float)y, (float)z+1.f, 0.f, (float)normal_direction, 0.f, 0.f+uv_x, 0.f+uv_y, 0.f+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b
-    };
-    // clang-format on
-
-    vertices->reserve(vertices->size() + std::distance(new_vertices.begin(), new_vertices.end()));
-    vertices->insert(vertices->end(), new_vertices.begin(), new_vertices.end());
-
-    push_indices(indices, offset, normal_direction);
-}
-
-void add_face_z(std::vector<float> *vertices, std::vector<unsigned int> *indices, int64_t x, int64_t y, int64_t z, float slice_height, float normal_direction, uint32_t base_id, glm::vec3 tint = {1., 1., 1.})
-{
-    size_t offset = vertices->size() / 13;
-
-    uint8_t face = normal_direction > 0 ? 0 : 5;
-    auto [uv_x, uv_y] = get_uv_offset(base_id, face);
-    auto [uv_ov_x, uv_ov_y] = get_uv_offset(base_id, face, true);
-
-    // clang-format off
-    const std::vector<float> new_vertices = {
-        (float)x, (float)y, (float)z, 0.f, 0.f, (float)normal_direction, 0.f+uv_x, 0.f+uv_y, 0.f+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x+1.f, (float)y, (float)z, 0.f, 0.f, (float)normal_direction, TEXTURE_TILE_WIDTH+uv_x, 0.f+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, 0.f+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x+1.f, (float)y+1.f, (float)z, 0.f, 0.f, (float)normal_direction, TEXTURE_TILE_WIDTH+uv_x, TEXTURE_TILE_HEIGHT+uv_y, TEXTURE_TILE_WIDTH+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b,
-        (float)x, (float)y+1.f, (float)z, 0.f, 0.f, (float)normal_direction, 0.f+uv_x, TEXTURE_TILE_HEIGHT+uv_y, 0.f+uv_ov_x, TEXTURE_TILE_HEIGHT+uv_ov_y, tint.r, tint.g, tint.b
-    };
-    // clang-format on
-
-    vertices->reserve(vertices->size() + distance(new_vertices.begin(), new_vertices.end()));
-    vertices->insert(vertices->end(), new_vertices.begin(), new_vertices.end());
-
-    push_indices(indices, offset, -normal_direction);
-}
-
-bool contains_and_not(std::vector<int> *vec, int elem, int dis)
-{
-    if (elem == dis)
-        return false;
-    for (size_t i = 0; i < vec->size(); i++)
-    {
-        if ((*vec)[i] == elem)
-            return true;
-    }
-    return false;
-}
-
-void generate_slice_mesh(World_t *world, Slice_t *slice, Chunk_t *chunk)
-{
-    Section_t *section = &world->section;
-    float slice_x = chunk->x;
-    float slice_y = chunk->y;
-    float slice_z = slice->z;
-    std::vector<float> *vertices = &slice->mesh_blocks.vertices;
-    std::vector<unsigned int> *indices = &slice->mesh_blocks.indices;
-    for (size_t x = 0; x < 16; x++)
-    {
-        for (size_t y = 0; y < 16; y++)
-        {
-            for (size_t z = 0; z < 16; z++)
-            {
-                Block_t *current_block = get_block(section, chunk, slice, x, y, z);
-                BlockId_t current_block_id = current_block->block_id;
-                bool g_top;
-                bool g_bottom;
-                bool g_left;
-                bool g_right;
-                bool g_front;
-                bool g_back;
-                switch (current_block_id)
-                {
-                case 0:
-                    // AIR
-                    continue;
-                    break;
-                case 6:
-                    vertices = &slice->mesh_foliage.vertices;
-                    indices = &slice->mesh_foliage.indices;
-                    {
-                        bool next_to_air = get_block(section, chunk, slice, x, y, z - 1)->block_id == 0 |
-                                           get_block(section, chunk, slice, x, y, z + 1)->block_id == 0 |
-                                           get_block(section, chunk, slice, x - 1, y, z)->block_id == 0 |
-                                           get_block(section, chunk, slice, x + 1, y, z)->block_id == 0 |
-                                           get_block(section, chunk, slice, x, y - 1, z)->block_id == 0 |
-                                           get_block(section, chunk, slice, x, y + 1, z)->block_id == 0;
-                        g_top = next_to_air;
-                        g_bottom = next_to_air;
-                        g_left = next_to_air;
-                        g_right = next_to_air;
-                        g_front = next_to_air;
-                        g_back = next_to_air;
-                        break;
-                    }
-                default:
-                    vertices = &slice->mesh_blocks.vertices;
-                    indices = &slice->mesh_blocks.indices;
-                    std::vector<int> allowed_ids = {0, 6};
-                    g_top = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x, y, z + 1)->block_id, current_block_id);
-                    g_bottom = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x, y, z - 1)->block_id, current_block_id);
-                    g_left = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x - 1, y, z)->block_id, current_block_id);
-                    g_right = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x + 1, y, z)->block_id, current_block_id);
-                    g_front = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x, y - 1, z)->block_id, current_block_id);
-                    g_back = contains_and_not(&allowed_ids, get_block(section, chunk, slice, x, y + 1, z)->block_id, current_block_id);
-                    break;
-                }
-
-                if (g_left)
-                {
-                    add_face_x(vertices, indices, x + slice_x, y + slice_y, z + slice_z, slice_z, -1, current_block_id, current_block->tint);
-                }
-                if (g_right)
-                {
-                    add_face_x(vertices, indices, x + slice_x + 1, y + slice_y, z + slice_z, slice_z, 1, current_block_id, current_block->tint);
-                }
-                if (g_front)
-                {
-                    add_face_y(vertices, indices, x + slice_x, y + slice_y, z + slice_z, slice_z, -1, current_block_id, current_block->tint);
-                }
-                if (g_back)
-                {
-                    add_face_y(vertices, indices, x + slice_x, y + slice_y + 1, z + slice_z, slice_z, 1, current_block_id, current_block->tint);
-                }
-                if (g_bottom)
-                {
-                    add_face_z(vertices, indices, x + slice_x, y + slice_y, z + slice_z, slice_z, -1, current_block_id, current_block->tint);
-                }
-                if (g_top)
-                {
-                    add_face_z(vertices, indices, x + slice_x, y + slice_y, z + slice_z + 1, slice_z, 1, current_block_id, current_block->tint);
-                }
-            }
-        }
-    }
-}
-
 static mContext_t C;
 
 void buildUi()
@@ -480,73 +86,44 @@ void buildUi()
     ImGui::Begin("stats");
     ImGui::Text("FPS %i", C.fps);
     ImGui::Text("dt %fms", (float)C.dt);
-    ImGui::Text("draw count %i", C.dc);
+    ImGui::Text("draw count %i, %zu quads", C.dc, C.drawn_quads);
+    ImGui::Text("slices drawn %zu, culled %zu, hidden %zu, occluded %zu", C.drawn_slices, C.culled_slices, C.hidden_slices, C.occluded_slices);
+    ImGui::Text("slices %i", (int)C.world->slices.size());
+    size_t faces = 0;
+    size_t quads = 0;
+    for (auto &entry : C.world->slices)
+    {
+        if (entry.second->status != SLICE_MESHED)
+            continue;
+        faces += entry.second->faces_count;
+        for (const RenderMesh_t &mesh : entry.second->meshes)
+        {
+            quads += mesh.quads_count;
+        }
+    }
+    ImGui::Text("vertices %zu, %zu without merging (-%.0f%%)", 4 * quads, 4 * faces, faces > 0 ? 100.f * (faces - quads) / faces : 0.f);
+    ImGui::Text("vertex memory %.1f MB, %zu tints", 4 * quads * sizeof(PackedVertex_t) / (1024.f * 1024.f), C.world->uploaded_tints);
+    ImGui::Checkbox("Greedy meshing", &C.debug.greedy_meshing);
+    ImGui::Checkbox("Level of detail", &C.debug.level_of_detail);
+    ImGui::Checkbox("Cave culling", &C.debug.cave_culling);
+    ImGui::Checkbox("Occlusion culling", &C.debug.occlusion_culling);
     ImGui::SliderFloat("SSAO strength", &C.debug.ssao_strength, 0.f, 1.f);
+    ImGui::SliderInt("Shadow cascades", &C.debug.shadow_cascades, 1, MAX_SHADOW_CASCADES);
+    ImGui::SliderInt("Shadow resolution", &C.debug.shadow_resolution, 512, 4096);
+    ImGui::SliderFloat("Shadow distance", &C.debug.shadow_distance, 32.f, 512.f);
     ImGui::SliderInt("Target fps", (int *)(&C.target_fps), 10, 240);
     ImGui::Text("position: %f, %f, %f", C.world->main_camera->position.x, C.world->main_camera->position.y, C.world->main_camera->position.z);
     ImGui::End();
-}
 
-char *readfile(const char *filepath)
-{
-    FILE *fp;
-    fopen_s(&fp, filepath, "r");
-    if (!fp)
-    {
-        printf("[ERROR] Failed to open %s", filepath);
-        return NULL;
-    }
-    fseek(fp, 0L, SEEK_END);
-    long lSize = ftell(fp);
-    rewind(fp);
-    char *buffer = (char *)calloc(1, lSize + 1);
-    if (!buffer)
-    {
-        printf("[ERROR] Failed to allocate memory for file %s", filepath);
-        return NULL;
-    }
-    fread(buffer, lSize, 1, fp);
-    return buffer;
-}
-
-void create_shader(const char *vertex_path, const char *fragment_path, unsigned int *program, const char *geometry_path = NULL)
-{
-    unsigned int vertex_shader, fragment_shader, geometry_shader = 0;
-    *program = glCreateProgram();
-    char *vertex_shader_source = readfile(vertex_path);
-    vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
-    free(vertex_shader_source);
-
-    char *fragment_shader_source = readfile(fragment_path);
-    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
-    free(fragment_shader_source);
-
-    if (geometry_path != NULL)
-    {
-        char *geometry_shader_source = readfile(geometry_path);
-        geometry_shader = glCreateShader(GL_GEOMETRY_SHADER);
-        glShaderSource(geometry_shader, 1, &geometry_shader_source, NULL);
-        glCompileShader(geometry_shader);
-        free(geometry_shader_source);
-    }
-
-    glAttachShader(*program, vertex_shader);
-    glAttachShader(*program, fragment_shader);
-    if (geometry_shader != 0)
-    {
-        glAttachShader(*program, geometry_shader);
-    }
-    glLinkProgram(*program);
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-    if (geometry_shader != 0)
-    {
-        glDeleteShader(geometry_shader);
-    }
+    // Camera chunk at the center, +y up
+    ImGui::Begin("map");
+    const float size = 1.f / C.map.chunks;
+    const float center_x = (block_to_chunk(floor(C.world->main_camera->position.x)) + 0.5f) * size;
+    const float center_y = (block_to_chunk(floor(C.world->main_camera->position.y)) + 0.5f) * size;
+    const float extent = (C.world->summary_radius + 0.5f) * size;
+    ImGui::Image((ImTextureID)(intptr_t)C.map.texture, ImVec2(512, 512), ImVec2(center_x - extent, center_y + extent), ImVec2(center_x + extent, center_y - extent));
+    ImGui::Text("summaries %i", (int)C.world->summaries.size());
+    ImGui::End();
 }
 
 void update_transform(Transform_t *transform)
@@ -750,23 +327,312 @@ void update_player(GLFWwindow *window)
     solve_collision(player, C.world);
 }
 
-void init_world(World_t *world)
+// Average color of an atlas tile, alpha weighted
+glm::vec4 average_tile_color(const unsigned char *atlas, int width, int channels, std::pair<int, int> tile)
+{
+    glm::vec4 sum = glm::vec4(0.f);
+    for (int y = 0; y < 16; y++)
+    {
+        for (int x = 0; x < 16; x++)
+        {
+            const unsigned char *pixel = &atlas[channels * ((16 * tile.second + y) * width + 16 * tile.first + x)];
+            const float alpha = channels == 4 ? pixel[3] / 255.f : 1.f;
+            sum += glm::vec4(alpha * pixel[0] / 255.f, alpha * pixel[1] / 255.f, alpha * pixel[2] / 255.f, alpha);
+        }
+    }
+    return sum.a > 0.f ? glm::vec4(glm::vec3(sum) / sum.a, sum.a / 256.f) : glm::vec4(0.f);
+}
+
+void init_far_map(FarMap_t *map, const unsigned char *atlas, int width, int channels, int32_t radius)
+{
+    for (const auto &block : blocks_uvs)
+    {
+        const auto &top = block.second[0];
+        const glm::vec4 base = average_tile_color(atlas, width, channels, top.first);
+        const glm::vec4 overlay = top.second != std::make_pair(0, 0) ? average_tile_color(atlas, width, channels, top.second) : glm::vec4(0.f);
+        map->colors[block.first] = MapColor_t{glm::vec3(base), glm::vec3(overlay), overlay.a};
+    }
+
+    map->chunks = 2 * radius + 1;
+    std::vector<unsigned char> pixels(16 * map->chunks * 16 * map->chunks * 4, 0);
+    glGenTextures(1, &map->texture);
+    glBindTexture(GL_TEXTURE_2D, map->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 16 * map->chunks, 16 * map->chunks, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+// Top block color, shaded by height and lit from the west
+void draw_summary(FarMap_t *map, ChunkSummary_t *summary)
+{
+    unsigned char pixels[16 * 16 * 4];
+    for (int y = 0; y < 16; y++)
+    {
+        for (int x = 0; x < 16; x++)
+        {
+            const size_t column = x + 16 * y;
+            const MapColor_t &color = map->colors[summary->top_blocks[column]];
+            const glm::vec3 tint = glm::vec3(summary->tints[column][0], summary->tints[column][1], summary->tints[column][2]) / 255.f;
+            const glm::vec3 top = glm::mix(color.base, color.overlay * tint, color.overlay_alpha);
+            const int32_t slope = summary->heights[std::min(x + 1, 15) + 16 * y] - summary->heights[std::max(x - 1, 0) + 16 * y];
+            const float shade = glm::clamp(0.7f + summary->heights[column] / 256.f - 0.08f * slope, 0.3f, 1.2f);
+            const glm::vec3 rgb = glm::clamp(top * shade, 0.f, 1.f) * 255.f;
+            pixels[4 * column + 0] = rgb.r;
+            pixels[4 * column + 1] = rgb.g;
+            pixels[4 * column + 2] = rgb.b;
+            pixels[4 * column + 3] = 255;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, map->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 16 * positive_mod(summary->x / 16, map->chunks), 16 * positive_mod(summary->y / 16, map->chunks),
+                    16, 16, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+void update_far_map(FarMap_t *map, World_t *world)
+{
+    std::vector<uint64_t> completed;
+    {
+        std::lock_guard<std::mutex> lock(world->scheduler.mutex);
+        completed.swap(world->scheduler.completed_summaries);
+    }
+    for (uint64_t key : completed)
+    {
+        auto summary = world->summaries.find(key);
+        if (summary != world->summaries.end())
+            draw_summary(map, summary->second);
+    }
+}
+
+// Indices of MAX_SLICE_QUADS quads, the same for every slice mesh
+unsigned int create_quad_index_buffer()
+{
+    std::vector<unsigned int> indices(6 * MAX_SLICE_QUADS);
+    for (unsigned int quad = 0; quad < MAX_SLICE_QUADS; quad++)
+    {
+        unsigned int *index = &indices[6 * quad];
+        index[0] = 4 * quad + 0;
+        index[1] = 4 * quad + 1;
+        index[2] = 4 * quad + 2;
+        index[3] = 4 * quad + 0;
+        index[4] = 4 * quad + 2;
+        index[5] = 4 * quad + 3;
+    }
+    // Filled through the array target, the element target belongs to the bound VAO
+    unsigned int ebo;
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    return ebo;
+}
+
+// Initial capacity of the geometry arena, in quads
+#define GEOMETRY_INITIAL_QUADS (1 << 20)
+
+void create_geometry_arena(GeometryArena_t *arena)
+{
+    glGenVertexArrays(1, &arena->vao);
+    glGenBuffers(1, &arena->vbo);
+    glGenBuffers(1, &arena->origins);
+    glGenBuffers(1, &arena->commands);
+
+    glBindVertexArray(arena->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glBufferData(GL_ARRAY_BUFFER, 4 * GEOMETRY_INITIAL_QUADS * sizeof(PackedVertex_t), NULL, GL_DYNAMIC_DRAW);
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(PackedVertex_t), (void *)0);
+    glEnableVertexAttribArray(0);
+
+    // Slice origin of each draw, picked by the base instance of its command
+    glBindBuffer(GL_ARRAY_BUFFER, arena->origins);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, C.quad_indices);
+    glBindVertexArray(0);
+    grow_geometry(arena, GEOMETRY_INITIAL_QUADS);
+}
+
+// Doubles the arena until count quads fit, the meshes keep their place
+void resize_geometry_arena(GeometryArena_t *arena, uint32_t count)
+{
+    uint32_t capacity = arena->capacity;
+    while (capacity < arena->capacity + count)
+    {
+        capacity *= 2;
+    }
+    unsigned int vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, 4 * (size_t)capacity * sizeof(PackedVertex_t), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, arena->vbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 4 * (size_t)arena->capacity * sizeof(PackedVertex_t));
+    glDeleteBuffers(1, &arena->vbo);
+    arena->vbo = vbo;
+
+    glBindVertexArray(arena->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(PackedVertex_t), (void *)0);
+    glBindVertexArray(0);
+    grow_geometry(arena, capacity);
+}
+
+void upload_render_mesh(RenderMesh_t *mesh)
+{
+    GeometryArena_t *arena = &C.geometry;
+    mesh->quads_count = mesh->vertices.size() / 4;
+    if (mesh->quads_count == 0)
+        return;
+    mesh->first_quad = allocate_geometry(arena, mesh->quads_count);
+    if (mesh->first_quad == GEOMETRY_ALLOCATION_FAILED)
+    {
+        resize_geometry_arena(arena, mesh->quads_count);
+        mesh->first_quad = allocate_geometry(arena, mesh->quads_count);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 4 * (size_t)mesh->first_quad * sizeof(PackedVertex_t), mesh->vertices.size() * sizeof(PackedVertex_t), mesh->vertices.data());
+    std::copy(mesh->face_quads, mesh->face_quads + 6, mesh->uploaded_face_quads);
+}
+
+void free_render_mesh(RenderMesh_t *mesh)
+{
+    free_geometry(&C.geometry, mesh->first_quad, mesh->quads_count);
+    mesh->quads_count = 0;
+}
+
+void free_slice_meshes(Slice_t *slice)
+{
+    for (RenderMesh_t &mesh : slice->meshes)
+    {
+        free_render_mesh(&mesh);
+    }
+}
+
+glm::vec3 slice_origin(const Slice_t *slice)
+{
+    return glm::vec3(slice->x, slice->y, slice->z);
+}
+
+// Union of the bounds of the uploaded meshes, min > max when they are all empty
+void update_slice_bounds(Slice_t *slice)
 {
-    world->section.x = 0;
-    world->section.y = 0;
-    float freqs[] = {0.01f, 0.06f};
-    float offsets[] = {30.f, 0.f};
-    float ampls[] = {8.f, 1.f};
-    init_perlin(&world->heightmap, freqs, offsets, ampls);
-    for (size_t chunk_id = 0; chunk_id < sizeof(world->section.chunks) / sizeof(Chunk_t *); chunk_id++)
+    slice->bounds_min = glm::vec3(16.f);
+    slice->bounds_max = glm::vec3(0.f);
+    for (const RenderMesh_t &mesh : slice->meshes)
     {
-        world->section.chunks[chunk_id] = nullptr;
+        if (mesh.quads_count == 0)
+            continue;
+        slice->bounds_min = glm::min(slice->bounds_min, mesh.bounds_min);
+        slice->bounds_max = glm::max(slice->bounds_max, mesh.bounds_max);
     }
+    slice->bounds_min += slice_origin(slice);
+    slice->bounds_max += slice_origin(slice);
 }
 
-void free_world(World_t *world)
+// Uploads the meshes finished by the workers, at most upload_budget. Remeshed
+// slices are drawn with their previous mesh until then
+void upload_completed_meshes(World_t *world, size_t upload_budget)
 {
-    free_perlin(&world->heightmap);
+    std::vector<CompletedMesh_t> meshes;
+    take_completed_meshes(world, upload_budget, &meshes);
+    for (const CompletedMesh_t &mesh : meshes)
+    {
+        Slice_t *slice = mesh.slice;
+        free_slice_meshes(slice);
+        sort_quads_back_to_front(&slice->meshes[LAYER_TRANSLUCENT], world->main_camera->position - slice_origin(slice));
+        for (int32_t layer = 0; layer < LAYERS_COUNT; layer++)
+        {
+            upload_render_mesh(&slice->meshes[layer]);
+            if (layer != LAYER_TRANSLUCENT)
+                release_mesh_vertices(world, &slice->meshes[layer]);
+        }
+        update_slice_bounds(slice);
+        finish_meshing(&mesh);
+    }
+}
+
+// Translucent quads are sorted again when the camera enters another slice only,
+// their order barely changes within a slice. Opaque and cutout quads never are
+void sort_translucent_meshes(World_t *world)
+{
+    const glm::vec3 camera = world->main_camera->position;
+    const SliceKey_t origin = {block_to_chunk(floor(camera.x)), block_to_chunk(floor(camera.y)), block_to_chunk(floor(camera.z))};
+    if (origin == C.translucent_origin)
+        return;
+    C.translucent_origin = origin;
+    for (auto &entry : world->slices)
+    {
+        Slice_t *slice = entry.second;
+        RenderMesh_t *mesh = &slice->meshes[LAYER_TRANSLUCENT];
+        // Busy slices may be remeshed, they are sorted on upload
+        if (slice->status != SLICE_MESHED || slice->busy || mesh->quads_count == 0)
+            continue;
+        sort_quads_back_to_front(mesh, camera - slice_origin(slice));
+        glBindBuffer(GL_ARRAY_BUFFER, C.geometry.vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 4 * (size_t)mesh->first_quad * sizeof(PackedVertex_t), mesh->vertices.size() * sizeof(PackedVertex_t), mesh->vertices.data());
+    }
+}
+
+// Level of detail wanted for the slice at key, by distance in slices to the camera
+uint8_t slice_lod(World_t *world, const SliceKey_t &key, int64_t center_x, int64_t center_y, int64_t center_z)
+{
+    if (!C.debug.level_of_detail)
+        return 0;
+    const int64_t distance = std::max({std::abs(key.x - center_x), std::abs(key.y - center_y), std::abs(key.z - center_z)});
+    uint8_t lod = 0;
+    while (lod < MAX_LOD && distance >= world->lod_distances[lod])
+    {
+        lod++;
+    }
+    return lod;
+}
+
+// Loads the slices within load_radius and load_height of the camera and unloads
+// the ones past it, queues the generation and meshing of the loaded slices then
+// uploads at most upload_budget meshes
+void update_world(World_t *world, size_t upload_budget)
+{
+    const int64_t center_x = block_to_chunk(floor(world->main_camera->position.x));
+    const int64_t center_y = block_to_chunk(floor(world->main_camera->position.y));
+    const int64_t center_z = block_to_chunk(floor(world->main_camera->position.z));
+    const int64_t radius = world->load_radius;
+    const int64_t height = world->load_height;
+
+    std::vector<Slice_t *> unloaded;
+    for (auto &entry : world->slices)
+    {
+        const SliceKey_t &key = entry.first;
+        const int64_t distance = std::max(std::abs(key.x - center_x), std::abs(key.y - center_y));
+        if ((distance > radius + 1 || std::abs(key.z - center_z) > height + 1) && !entry.second->busy && entry.second->pins == 0)
+            unloaded.push_back(entry.second);
+    }
+    for (Slice_t *slice : unloaded)
+    {
+        free_slice_meshes(slice);
+        unload_slice(world, slice);
+    }
+
+    for (int64_t z = center_z - height; z <= center_z + height; z++)
+    {
+        for (int64_t y = center_y - radius; y <= center_y + radius; y++)
+        {
+            for (int64_t x = center_x - radius; x <= center_x + radius; x++)
+            {
+                if (find_slice(world, x, y, z) == NULL)
+                    load_slice(world, x, y, z);
+            }
+        }
+    }
+
+    for (auto &entry : world->slices)
+    {
+        entry.second->target_lod = slice_lod(world, entry.first, center_x, center_y, center_z);
+    }
+    schedule_generation(world);
+    schedule_meshing(world, C.debug.greedy_meshing);
+    update_summaries(world, center_x, center_y);
+    upload_completed_meshes(world, upload_budget);
 }
 
 void record_framebuffer(unsigned int *gBuffer, unsigned int *gPosition, unsigned int *gNormal, unsigned int *gColor, uint32_t width, uint32_t height)
@@ -811,47 +677,260 @@ void record_framebuffer(unsigned int *gBuffer, unsigned int *gPosition, unsigned
     unsigned int rboDepth;
     glGenRenderbuffers(1, &rboDepth);
     glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    // Same format as the default framebuffer, the depth is blitted to it for the translucent layer
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void render_world(World_t *world)
+// Base and overlay tiles (column, row) of each face of each block, fetched by the vertex shader
+unsigned int create_block_tiles_texture()
 {
-    for (size_t i = 0; i < sizeof(world->section.chunks) / sizeof(Chunk_t *); i++)
+    BlockId_t max_id = 0;
+    for (const auto &block : blocks_uvs)
     {
-        if (world->section.chunks[i] == nullptr)
-            continue;
-        Chunk_t *chunk = world->section.chunks[i];
-        for (size_t slice_index = 0; slice_index < 24; slice_index++)
+        max_id = std::max(max_id, block.first);
+    }
+    std::vector<uint8_t> tiles(6 * 4 * (max_id + 1), 0);
+    for (const auto &block : blocks_uvs)
+    {
+        for (size_t face = 0; face < 6; face++)
         {
-            Slice_t *slice = &chunk->slices[slice_index];
-            if (slice == nullptr)
-                continue;
-            size_t count = slice->mesh_blocks.indices.size();
-            if (count != 0)
-            {
-                glBindVertexArray(slice->mesh_blocks.vao);
+            uint8_t *texel = &tiles[4 * (6 * block.first + face)];
+            texel[0] = block.second[face].first.first;
+            texel[1] = block.second[face].first.second;
+            texel[2] = block.second[face].second.first;
+            texel[3] = block.second[face].second.second;
+        }
+    }
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, 6, max_id + 1, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, tiles.data());
+    return texture;
+}
 
-                glEnable(GL_CULL_FACE);
-                glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
-                C.dc++;
-            }
+unsigned int create_tint_palette_texture()
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, TINT_PALETTE_SIZE / 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    return texture;
+}
 
-            count = slice->mesh_foliage.indices.size();
-            if (count != 0)
-            {
-                glBindVertexArray(slice->mesh_foliage.vao);
+// Uploads the tints added since the last call
+void upload_tint_palette(World_t *world, unsigned int texture)
+{
+    std::lock_guard<std::mutex> lock(world->tints_mutex);
+    if (world->uploaded_tints == world->tints.size())
+        return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    while (world->uploaded_tints < world->tints.size())
+    {
+        const size_t x = world->uploaded_tints % 256;
+        const size_t count = std::min(256 - x, world->tints.size() - world->uploaded_tints);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, world->uploaded_tints / 256, count, 1, GL_RGBA, GL_UNSIGNED_BYTE, &world->tints[world->uploaded_tints]);
+        world->uploaded_tints += count;
+    }
+}
+
+// Faces of the slice that can point toward viewer, a bit per face (see FACE_*).
+// Faces lie between the slice bounds, only the ones behind the viewer are skipped
+uint8_t facing_faces(const Slice_t *slice, const glm::vec3 &viewer)
+{
+    const glm::vec3 min = glm::vec3(slice->x, slice->y, slice->z);
+    const glm::vec3 max = min + 16.f;
+    return (viewer.z > min.z) << FACE_TOP |
+           (viewer.y < max.y) << FACE_FRONT |
+           (viewer.x < max.x) << FACE_LEFT |
+           (viewer.y > min.y) << FACE_BACK |
+           (viewer.x > min.x) << FACE_RIGHT |
+           (viewer.z < max.z) << FACE_BOTTOM;
+}
 
-                // glDisable(GL_CULL_FACE);
-                glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
-                C.dc++;
+// Adds the draws of the faces of mesh set in faces, consecutive faces as a single command
+void add_mesh_draws(DrawList_t *draws, const Slice_t *slice, const RenderMesh_t *mesh, uint8_t faces)
+{
+    uint32_t first = 0;
+    bool open = false;
+    for (int32_t face = 0; face < 6; face++)
+    {
+        const uint32_t quads = mesh->uploaded_face_quads[face];
+        if (faces & 1 << face && quads != 0)
+        {
+            if (!open)
+            {
+                const uint32_t draw = draws->commands.size();
+                draws->commands.push_back(DrawCommand_t{0, 1, 6 * first, (int32_t)(4 * mesh->first_quad), draw});
+                draws->origins.push_back(slice_origin(slice));
+                open = true;
             }
+            draws->commands.back().count += 6 * quads;
+            C.drawn_quads += quads;
+        }
+        else
+        {
+            open = open && quads == 0;
+        }
+        first += quads;
+    }
+}
+
+// Meshed slices with a mesh in frustum, tested from their bounds. Returns how
+// many were culled
+size_t cull_slices(World_t *world, const Frustum_t *frustum, std::vector<Slice_t *> *visible)
+{
+    BoxList_t *boxes = &C.slice_boxes;
+    clear_boxes(boxes);
+    visible->clear();
+    for (auto &entry : world->slices)
+    {
+        Slice_t *slice = entry.second;
+        if (slice->status != SLICE_MESHED || slice->bounds_min.x > slice->bounds_max.x)
+            continue;
+        add_box(boxes, slice->bounds_min, slice->bounds_max);
+        visible->push_back(slice);
+    }
+    cull_boxes(frustum, boxes);
+    size_t kept = 0;
+    for (size_t i = 0; i < visible->size(); i++)
+    {
+        if (boxes->visible[i])
+            (*visible)[kept++] = (*visible)[i];
+    }
+    const size_t culled = visible->size() - kept;
+    visible->resize(kept);
+    return culled;
+}
+
+// Breadth first search from the camera slice through the faces each slice
+// connects, moving away from the camera only and within frustum. Returns false
+// when the camera isn't in a loaded slice, nothing is reached then
+bool find_visible_slices(World_t *world, const glm::vec3 &camera, const Frustum_t *frustum)
+{
+    Slice_t *start = find_slice(world, block_to_chunk(floor(camera.x)), block_to_chunk(floor(camera.y)), block_to_chunk(floor(camera.z)));
+    if (start == NULL)
+        return false;
+    const uint32_t search = ++C.visibility_search;
+    std::vector<VisibilityStep_t> &queue = C.visibility_queue;
+    queue.clear();
+    queue.push_back(VisibilityStep_t{start, 0, 0});
+    start->visibility_search = search;
+    for (size_t step = 0; step < queue.size(); step++)
+    {
+        const VisibilityStep_t current = queue[step];
+        // The camera can look through any face of its slice
+        const uint8_t exits = current.slice == start ? 0x3F : current.slice->face_connections[current.entry];
+        for (int32_t face = 0; face < 6; face++)
+        {
+            if ((exits & 1 << face) == 0 || current.directions & 1 << opposite_faces[face])
+                continue;
+            Slice_t *neighbor = current.slice->neighbors[neighbor_index(face_neighbors[face][0], face_neighbors[face][1], face_neighbors[face][2])];
+            if (neighbor == NULL || neighbor->visibility_search == search)
+                continue;
+            const glm::vec3 origin = slice_origin(neighbor);
+            if (!box_in_frustum(frustum, origin, origin + 16.f))
+                continue;
+            neighbor->visibility_search = search;
+            queue.push_back(VisibilityStep_t{neighbor, opposite_faces[face], (uint8_t)(current.directions | 1 << face)});
+        }
+    }
+    return true;
+}
+
+// Drops the slices find_visible_slices didn't reach, returns how many
+size_t remove_hidden_slices(std::vector<Slice_t *> *slices)
+{
+    const size_t count = slices->size();
+    slices->erase(std::remove_if(slices->begin(), slices->end(), [](const Slice_t *slice)
+                                 { return slice->visibility_search != C.visibility_search; }),
+                  slices->end());
+    return count - slices->size();
+}
+
+// Rasterizes the occluders of slices on the CPU then drops the slices behind
+// them, returns how many
+size_t remove_occluded_slices(std::vector<Slice_t *> *slices, const glm::mat4 &view_projection)
+{
+    OcclusionBuffer_t *buffer = &C.occlusion;
+    clear_occlusion(buffer, view_projection);
+    for (const Slice_t *slice : *slices)
+    {
+        const glm::vec3 origin = slice_origin(slice);
+        for (const Occluder_t &occluder : slice->occluders)
+        {
+            const glm::vec3 min = origin + glm::vec3(occluder.min[0], occluder.min[1], occluder.min[2]);
+            const glm::vec3 max = origin + glm::vec3(occluder.max[0], occluder.max[1], occluder.max[2]);
+            rasterize_occluder(buffer, min, max);
         }
     }
+    const size_t count = slices->size();
+    slices->erase(std::remove_if(slices->begin(), slices->end(), [buffer](const Slice_t *slice)
+                                 { return box_occluded(buffer, slice->bounds_min, slice->bounds_max); }),
+                  slices->end());
+    return count - slices->size();
+}
+
+// Faces pointing away from viewer are skipped, all faces are drawn without one
+void add_layer_draws(DrawList_t *draws, const std::vector<Slice_t *> &slices, const glm::vec3 *viewer, RenderLayer layer)
+{
+    for (Slice_t *slice : slices)
+    {
+        const RenderMesh_t *mesh = &slice->meshes[layer];
+        if (mesh->quads_count == 0)
+            continue;
+        const uint8_t faces = viewer == NULL ? 0x3F : facing_faces(slice, *viewer);
+        if (faces == 0)
+            continue;
+        add_mesh_draws(draws, slice, mesh, faces);
+    }
+}
+
+// Translucent meshes from the farthest slice to the closest, each drawn whole
+// since its quads are sorted, see sort_translucent_meshes
+void add_translucent_draws(DrawList_t *draws, const std::vector<Slice_t *> &visible, const glm::vec3 &viewer)
+{
+    std::vector<std::pair<float, Slice_t *>> slices;
+    for (Slice_t *slice : visible)
+    {
+        if (slice->meshes[LAYER_TRANSLUCENT].quads_count == 0)
+            continue;
+        const glm::vec3 offset = slice_origin(slice) + 8.f - viewer;
+        slices.push_back({glm::dot(offset, offset), slice});
+    }
+    std::sort(slices.begin(), slices.end(), [](const std::pair<float, Slice_t *> &a, const std::pair<float, Slice_t *> &b)
+              { return a.first > b.first; });
+    for (const auto &entry : slices)
+    {
+        add_mesh_draws(draws, entry.second, &entry.second->meshes[LAYER_TRANSLUCENT], 0x3F);
+    }
+}
+
+void upload_draw_list(GeometryArena_t *arena, const DrawList_t *draws)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, arena->origins);
+    glBufferData(GL_ARRAY_BUFFER, draws->origins.size() * sizeof(glm::vec3), draws->origins.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena->commands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, draws->commands.size() * sizeof(DrawCommand_t), draws->commands.data(), GL_STREAM_DRAW);
+}
+
+// Submits the uploaded commands from first to last in a single draw
+void draw_geometry(GeometryArena_t *arena, size_t first, size_t last)
+{
+    if (first == last)
+        return;
+    glBindVertexArray(arena->vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena->commands);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)(first * sizeof(DrawCommand_t)), last - first, 0);
+    C.dc++;
 }
 
 int main(int argc, char **argv)
@@ -891,11 +970,20 @@ int main(int argc, char **argv)
     double last_time = glfwGetTime();
 
     // Shader creation
-    unsigned int cube_shader_program;
-    create_shader("resources/blocks.vert", "resources/blocks.frag", &cube_shader_program);
+    ShaderProgram_t cube_shader_program;
+    if (!create_program(&cube_shader_program, "resources/blocks.vert", "resources/blocks.frag"))
+        exit(EXIT_FAILURE);
+
+    ShaderProgram_t deferred_shader_program;
+    if (!create_program(&deferred_shader_program, "resources/deferred.vert", "resources/deferred.frag"))
+        exit(EXIT_FAILURE);
+
+    ShaderProgram_t translucent_shader_program;
+    if (!create_program(&translucent_shader_program, "resources/blocks.vert", "resources/translucent.frag"))
+        exit(EXIT_FAILURE);
 
-    unsigned int deferred_shader_program;
-    create_shader("resources/deferred.vert", "resources/deferred.frag", &deferred_shader_program);
+    // View projection, light space matrix and SSAO parameters, shared by every program
+    unsigned int frame_uniforms = create_frame_uniforms();
 
     // Texture
     int texture_width, texture_height, texture_depth;
@@ -914,13 +1002,30 @@ int main(int argc, char **argv)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture_width, texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture_data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    init_far_map(&C.map, texture_data, texture_width, texture_depth, World_t().summary_radius);
     stbi_image_free(texture_data);
 
+    C.quad_indices = create_quad_index_buffer();
+    create_geometry_arena(&C.geometry);
+    unsigned int block_tiles_texture = create_block_tiles_texture();
+    unsigned int tint_palette_texture = create_tint_palette_texture();
+
     // Shader select
-    glUseProgram(cube_shader_program);
+    glUseProgram(cube_shader_program.id);
+    glUniform1i(uniform_location(&cube_shader_program, "blocksTexture"), 0);
+    glUniform1i(uniform_location(&cube_shader_program, "block_tiles"), 1);
+    glUniform1i(uniform_location(&cube_shader_program, "tint_palette"), 2);
+    int alpha_cutoff_loc = uniform_location(&cube_shader_program, "alpha_cutoff");
+
+    glUseProgram(translucent_shader_program.id);
+    glUniform1i(uniform_location(&translucent_shader_program, "blocksTexture"), 0);
+    glUniform1i(uniform_location(&translucent_shader_program, "block_tiles"), 1);
+    glUniform1i(uniform_location(&translucent_shader_program, "tint_palette"), 2);
 
     World_t world;
     init_world(&world);
+    // Untinted blocks use the first entry
+    find_or_add_tint(&world, glm::vec3(1.f));
     C.world = &world;
 
     Camera_t camera = {};
@@ -937,91 +1042,7 @@ int main(int argc, char **argv)
     // camera.mode = CameraMode::Player;
     camera.mode = CameraMode::Freeflight;
 
-    // Uniforms
-    int modelLoc = glGetUniformLocation(cube_shader_program, "view_projection");
-
-    for (int i = 0; i < 10; i++)
-    {
-        for (int j = 0; j < 10; j++)
-        {
-            // Test chunk removal
-            // if (i==4 && j==3) continue;
-            Chunk_t *chunk = new Chunk_t;
-            init_chunk(chunk, &world.section, j, i);
-            generate_chunk(&world, chunk);
-            world.section.chunks[chunk_id(j, i)] = chunk;
-        }
-    }
-    for (size_t i = 0; i < 40; i++)
-    {
-        const int64_t x = (float)rand() / (float)RAND_MAX * 10 * 16;
-        const int64_t y = (float)rand() / (float)RAND_MAX * 10 * 16;
-        spawn_tree(&world, glm::vec3(x, y, sample_perlin(&world.heightmap, x, y, 0) + 1), 4);
-    }
-
-    for (int i = 0; i < 16; i++)
-    {
-        for (int j = 0; j < 16; j++)
-        {
-            Chunk_t *chunk = world.section.chunks[chunk_id(j, i)];
-            if (chunk == NULL)
-                continue;
-            for (size_t slice_index = 0; slice_index < 24; slice_index++)
-            {
-                Slice_t *slice = &chunk->slices[slice_index];
-                generate_slice_mesh(&world, slice, chunk);
-                // VAO
-                glGenVertexArrays(1, &slice->mesh_blocks.vao);
-                glGenBuffers(1, &slice->mesh_blocks.vbo);
-                glGenBuffers(1, &slice->mesh_blocks.ebo);
-
-                glBindVertexArray(slice->mesh_blocks.vao);
-
-                // VBO
-                glBindBuffer(GL_ARRAY_BUFFER, slice->mesh_blocks.vbo);
-                glBufferData(GL_ARRAY_BUFFER, slice->mesh_blocks.vertices.size() * sizeof(float), slice->mesh_blocks.vertices.data(), GL_STATIC_DRAW);
-                // EBO
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, slice->mesh_blocks.ebo);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, slice->mesh_blocks.indices.size() * sizeof(unsigned int), slice->mesh_blocks.indices.data(), GL_STATIC_DRAW);
-
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)0);
-                glEnableVertexAttribArray(0);
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(3 * sizeof(float)));
-                glEnableVertexAttribArray(1);
-                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(6 * sizeof(float)));
-                glEnableVertexAttribArray(2);
-                glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(8 * sizeof(float)));
-                glEnableVertexAttribArray(3);
-                glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(10 * sizeof(float)));
-                glEnableVertexAttribArray(4);
-
-                // VAO
-                glGenVertexArrays(1, &slice->mesh_foliage.vao);
-                glGenBuffers(1, &slice->mesh_foliage.vbo);
-                glGenBuffers(1, &slice->mesh_foliage.ebo);
-
-                glBindVertexArray(slice->mesh_foliage.vao);
-
-                // VBO
-                glBindBuffer(GL_ARRAY_BUFFER, slice->mesh_foliage.vbo);
-                glBufferData(GL_ARRAY_BUFFER, slice->mesh_foliage.vertices.size() * sizeof(float), slice->mesh_foliage.vertices.data(), GL_STATIC_DRAW);
-                // EBO
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, slice->mesh_foliage.ebo);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, slice->mesh_foliage.indices.size() * sizeof(unsigned int), slice->mesh_foliage.indices.data(), GL_STATIC_DRAW);
-
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)0);
-                glEnableVertexAttribArray(0);
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(3 * sizeof(float)));
-                glEnableVertexAttribArray(1);
-                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(6 * sizeof(float)));
-                glEnableVertexAttribArray(2);
-                glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(8 * sizeof(float)));
-                glEnableVertexAttribArray(3);
-                glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 13 * sizeof(float), (void *)(10 * sizeof(float)));
-                glEnableVertexAttribArray(4);
-            }
-        }
-    }
+    start_generation(&world, std::max(2u, std::thread::hardware_concurrency()) - 1);
 
     unsigned int gBuffer, gPosition, gNormal, gColor = 0;
 
@@ -1056,7 +1077,9 @@ int main(int argc, char **argv)
         sample *= scale;
         ssaoKernel.push_back(sample);
     }
-    int samples_loc = glGetUniformLocation(deferred_shader_program, "hemisphere_samples");
+    // The kernel never changes, uploaded once
+    glUseProgram(deferred_shader_program.id);
+    glUniform3fv(uniform_location(&deferred_shader_program, "hemisphere_samples"), (int)ssaoKernel.size(), &ssaoKernel[0][0]);
 
     std::vector<glm::vec3> ssaoNoise;
     for (unsigned int i = 0; i < 16; i++)
@@ -1085,36 +1108,21 @@ int main(int argc, char **argv)
     double last_frame_time = glfwGetTime();
 
     // Shadows
-    unsigned int shadow_depth_fbo;
-    glGenFramebuffers(1, &shadow_depth_fbo);
-    const unsigned int shadow_width = 4096, shadow_height = 4096;
-    unsigned int shadow_depth_map;
-    glGenTextures(1, &shadow_depth_map);
-    glBindTexture(GL_TEXTURE_2D, shadow_depth_map);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-                 shadow_width, shadow_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, shadow_depth_fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadow_depth_map, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    unsigned int shadow_shader_program;
-    create_shader("resources/shadow.vert", "resources/shadow.frag", &shadow_shader_program);
-
-    float near_plane = 10.0f, far_plane = 200.f;
+    ShadowCascades_t shadows;
+    ShaderProgram_t shadow_shader_program;
+    if (!create_program(&shadow_shader_program, "resources/shadow.vert", "resources/shadow.frag"))
+        exit(EXIT_FAILURE);
+    int cascade_loc = uniform_location(&shadow_shader_program, "cascade");
 
     double t = 0.;
+    FrameUniforms_t frame = {};
+    DrawList_t draws;
+    std::vector<Slice_t *> shadow_slices[MAX_SHADOW_CASCADES];
+    std::vector<Slice_t *> visible_slices;
     while (!glfwWindowShouldClose(window))
     {
         C.dc = 0;
+        C.drawn_quads = 0;
         double current_time = glfwGetTime();
         double elapsed_time = current_time - last_time;
         if (C.target_fps > 0 && elapsed_time < 1.f / (float)C.target_fps)
@@ -1127,15 +1135,15 @@ int main(int argc, char **argv)
         last_time = current_time;
         t += elapsed_time;
 
-        // Update light position
+        // Update light direction
         const float light_speed = 0.1f;
-        glm::mat4 lightProjection = glm::ortho(-100.0f, 100.f, -100.0f, 100.0f, near_plane, far_plane);
-        glm::mat4 lightView = glm::lookAt(glm::vec3(80.f + 90.0f * glm::cos(light_speed * (float)t), 80.0f + 90.f * glm::sin(light_speed * (float)t), 80.0f),
-                                          glm::vec3(80.0f, 80.0f, 40.0f),
-                                          glm::vec3(0.0f, 0.0f, 1.0f));
-        glm::mat4 lightSpaceMatrix = lightProjection * lightView;
+        const glm::vec3 light_direction = glm::normalize(glm::vec3(-90.f * glm::cos(light_speed * (float)t), -90.f * glm::sin(light_speed * (float)t), -40.f));
 
         update_player(window);
+        update_world(&world, 64);
+        upload_tint_palette(&world, tint_palette_texture);
+        sort_translucent_meshes(&world);
+        update_far_map(&C.map, &world);
         Camera_t *camera = C.world->main_camera;
         camera->direction = {cos(glm::radians(camera->yaw)) * cos(glm::radians(camera->pitch)), -sin(glm::radians(camera->yaw)) * cos(glm::radians(camera->pitch)), sin(glm::radians(camera->pitch))};
         glm::mat4 view = glm::lookAt(camera->position, camera->position + camera->direction, camera->up);
@@ -1155,15 +1163,63 @@ int main(int argc, char **argv)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        resize_shadow_cascades(&shadows, C.debug.shadow_cascades, C.debug.shadow_resolution);
+        fit_shadow_cascades(&shadows, camera, (float)screen_width / (float)screen_height, light_direction, C.debug.shadow_distance);
+
+        // Shadow casters are culled against the frustum of their cascade, they can be out of view
+        for (int i = 0; i < shadows.count; i++)
+        {
+            const Frustum_t light_frustum = frustum_from_matrix(shadows.matrices[i]);
+            cull_slices(&world, &light_frustum, &shadow_slices[i]);
+        }
+        const Frustum_t camera_frustum = frustum_from_matrix(VP);
+        C.culled_slices = cull_slices(&world, &camera_frustum, &visible_slices);
+        C.hidden_slices = 0;
+        if (C.debug.cave_culling && find_visible_slices(&world, camera->position, &camera_frustum))
+            C.hidden_slices = remove_hidden_slices(&visible_slices);
+        C.occluded_slices = 0;
+        if (C.debug.occlusion_culling)
+            C.occluded_slices = remove_occluded_slices(&visible_slices, VP);
+        C.drawn_slices = visible_slices.size();
+
+        // Every draw of the frame, each pass submits its range at once. Translucent blocks don't cast shadows
+        draws.commands.clear();
+        draws.origins.clear();
+        size_t cascade_draws[MAX_SHADOW_CASCADES + 1] = {0};
+        for (int i = 0; i < shadows.count; i++)
+        {
+            add_layer_draws(&draws, shadow_slices[i], NULL, LAYER_OPAQUE);
+            add_layer_draws(&draws, shadow_slices[i], NULL, LAYER_CUTOUT);
+            cascade_draws[i + 1] = draws.commands.size();
+        }
+        const size_t opaque_draws = draws.commands.size();
+        add_layer_draws(&draws, visible_slices, &camera->position, LAYER_OPAQUE);
+        const size_t cutout_draws = draws.commands.size();
+        add_layer_draws(&draws, visible_slices, &camera->position, LAYER_CUTOUT);
+        const size_t translucent_draws = draws.commands.size();
+        add_translucent_draws(&draws, visible_slices, camera->position);
+        upload_draw_list(&C.geometry, &draws);
+
+        frame.view_projection = VP;
+        for (int i = 0; i < shadows.count; i++)
+            frame.light_space_matrices[i] = shadows.matrices[i];
+        frame.ssao_strength = C.debug.ssao_strength;
+        frame.shadow_cascades = shadows.count;
+        upload_frame_uniforms(frame_uniforms, &frame);
+
         // Shadows
         glEnable(GL_DEPTH_TEST);
-        glBindFramebuffer(GL_FRAMEBUFFER, shadow_depth_fbo);
-        glViewport(0, 0, shadow_width, shadow_height);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        glUseProgram(shadow_shader_program);
-        glUniformMatrix4fv(glGetUniformLocation(shadow_shader_program, "light_space_matrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        render_world(&world);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glViewport(0, 0, shadows.resolution, shadows.resolution);
+        glUseProgram(shadow_shader_program.id);
+        glEnable(GL_CULL_FACE);
+        for (int i = 0; i < shadows.count; i++)
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.texture, 0, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glUniform1i(cascade_loc, i);
+            draw_geometry(&C.geometry, cascade_draws[i], cascade_draws[i + 1]);
+        }
 
         // glClearColor(0.0, 0.0, 0.0, 1.0);
         // glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -1174,13 +1230,19 @@ int main(int argc, char **argv)
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glViewport(0, 0, screen_width, screen_height);
 
-        glUseProgram(cube_shader_program);
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(VP));
+        glUseProgram(cube_shader_program.id);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, blocks_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, block_tiles_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, tint_palette_texture);
 
-        render_world(&world);
+        glUniform1f(alpha_cutoff_loc, 0.f);
+        draw_geometry(&C.geometry, opaque_draws, cutout_draws);
+        glUniform1f(alpha_cutoff_loc, 0.5f);
+        draw_geometry(&C.geometry, cutout_draws, translucent_draws);
 
         // Deferred
         glDisable(GL_DEPTH_TEST);
@@ -1191,12 +1253,7 @@ int main(int argc, char **argv)
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glViewport(0, 0, screen_width, screen_height);
 
-        glUseProgram(deferred_shader_program);
-        glUniformMatrix4fv(glGetUniformLocation(deferred_shader_program, "projection"), 1, GL_FALSE, glm::value_ptr(VP));
-        glUniformMatrix4fv(glGetUniformLocation(deferred_shader_program, "light_space_matrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        glUniform1fv(glGetUniformLocation(deferred_shader_program, "ssao_strength"), 1, &C.debug.ssao_strength);
-        for (unsigned int i = 0; i < 64; ++i)
-            glUniform3fv(glGetUniformLocation(deferred_shader_program, ("hemisphere_samples[" + std::to_string(i) + "]").c_str()), 1, &ssaoKernel[i][0]);
+        glUseProgram(deferred_shader_program.id);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, gPosition);
@@ -1205,12 +1262,36 @@ int main(int argc, char **argv)
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, gColor);
         glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, shadow_depth_map);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadows.texture);
         glActiveTexture(GL_TEXTURE10);
         glBindTexture(GL_TEXTURE_2D, noiseTexture);
 
         glBindVertexArray(fullscreen_vao);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+        // Translucent, blended over the lit scene and tested against the G-buffer depth
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, screen_width, screen_height, 0, 0, screen_width, screen_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        glUseProgram(translucent_shader_program.id);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, blocks_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, block_tiles_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, tint_palette_texture);
+        glEnable(GL_CULL_FACE);
+        draw_geometry(&C.geometry, translucent_draws, draws.commands.size());
+
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         buildUi();
@@ -1219,14 +1300,14 @@ int main(int argc, char **argv)
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
-    for (size_t i = 0; i < sizeof(world.section.chunks) / sizeof(Chunk_t *); i++)
+    stop_generation(&world);
+    while (!world.slices.empty())
     {
-        if (world.section.chunks[i] != nullptr)
-        {
-            free(world.section.chunks[i]);
-        }
+        Slice_t *slice = world.slices.begin()->second;
+        free_slice_meshes(slice);
+        unload_slice(&world, slice);
     }
-    free_world(&world);
+    unload_summaries(&world);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
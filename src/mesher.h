@@ -0,0 +1,920 @@
+#ifndef MESHER_H
+#define MESHER_H
+
+#include <cstdio>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "types.h"
+#include "world.h"
+
+// Slice meshing, runs on the generation workers (see pipeline.h). Meshers only
+// read the slice and its neighbors blocks, which don't change once lit, and
+// write into the slice render meshes. The GL upload is left to the main thread.
+
+// Slice local corner, at most 16 on each axis. ao goes from 0 (occluded) to 3
+inline PackedVertex_t pack_vertex(uint32_t x, uint32_t y, uint32_t z, uint8_t face, BlockId_t block_id, uint16_t tint, uint32_t ao)
+{
+    return PackedVertex_t{x | y << 5 | z << 10 | (uint32_t)face << 15 | ao << 18, block_id | (uint32_t)tint << 16};
+}
+
+// Ambient occlusion of the four corners of a face, 2 bits each in the
+// add_face_* corners order. Unoccluded by default
+#define NO_OCCLUSION 0xFF
+
+inline uint32_t corner_ao(uint8_t ao, int32_t corner)
+{
+    return ao >> 2 * corner & 3;
+}
+
+// Quads are drawn with the shared index pattern (0, 1, 2, 0, 2, 3), reversed
+// quads are written in the other order to face the other way. Flipped quads
+// are rotated by a corner to split them along the (b, d) diagonal instead
+inline void push_quad(MeshArena_t *arena, uint8_t face, PackedVertex_t a, PackedVertex_t b, PackedVertex_t c, PackedVertex_t d, bool reversed, bool flipped)
+{
+    if (flipped)
+    {
+        const PackedVertex_t first = a;
+        a = b;
+        b = c;
+        c = d;
+        d = first;
+    }
+    PackedVertex_t *vertices = arena->vertices.data() + arena->face_end[face];
+    vertices[0] = a;
+    vertices[1] = reversed ? d : b;
+    vertices[2] = c;
+    vertices[3] = reversed ? b : d;
+    arena->face_end[face] += 4;
+}
+
+// Interpolating the occlusion along the darker diagonal makes it anisotropic
+inline bool flip_quad(uint8_t ao)
+{
+    return corner_ao(ao, 0) + corner_ao(ao, 2) < corner_ao(ao, 1) + corner_ao(ao, 3);
+}
+
+// x, y, z local to the slice. Faces span width x height blocks, the shaders
+// derive the normal and the tiles from the face and repeat them over the face
+void add_face_x(MeshArena_t *arena, uint32_t x, uint32_t y, uint32_t z, float normal_direction, BlockId_t base_id, uint16_t tint = 0, uint32_t width = 1, uint32_t height = 1, uint8_t ao = NO_OCCLUSION)
+{
+    uint8_t face = normal_direction > 0 ? 4 : 2;
+    push_quad(arena, face,
+              pack_vertex(x, y, z, face, base_id, tint, corner_ao(ao, 0)),
+              pack_vertex(x, y + width, z, face, base_id, tint, corner_ao(ao, 1)),
+              pack_vertex(x, y + width, z + height, face, base_id, tint, corner_ao(ao, 2)),
+              pack_vertex(x, y, z + height, face, base_id, tint, corner_ao(ao, 3)),
+              normal_direction < 0, flip_quad(ao));
+}
+
+void add_face_y(MeshArena_t *arena, uint32_t x, uint32_t y, uint32_t z, float normal_direction, BlockId_t base_id, uint16_t tint = 0, uint32_t width = 1, uint32_t height = 1, uint8_t ao = NO_OCCLUSION)
+{
+    uint8_t face = normal_direction > 0 ? 3 : 1;
+    push_quad(arena, face,
+              pack_vertex(x, y, z, face, base_id, tint, corner_ao(ao, 0)),
+              pack_vertex(x + width, y, z, face, base_id, tint, corner_ao(ao, 1)),
+              pack_vertex(x + width, y, z + height, face, base_id, tint, corner_ao(ao, 2)),
+              pack_vertex(x, y, z + height, face, base_id, tint, corner_ao(ao, 3)),
+              normal_direction > 0, flip_quad(ao));
+}
+
+void add_face_z(MeshArena_t *arena, uint32_t x, uint32_t y, uint32_t z, float normal_direction, BlockId_t base_id, uint16_t tint = 0, uint32_t width = 1, uint32_t height = 1, uint8_t ao = NO_OCCLUSION)
+{
+    uint8_t face = normal_direction > 0 ? 0 : 5;
+    push_quad(arena, face,
+              pack_vertex(x, y, z, face, base_id, tint, corner_ao(ao, 0)),
+              pack_vertex(x + width, y, z, face, base_id, tint, corner_ao(ao, 1)),
+              pack_vertex(x + width, y + height, z, face, base_id, tint, corner_ao(ao, 2)),
+              pack_vertex(x, y + height, z, face, base_id, tint, corner_ao(ao, 3)),
+              normal_direction < 0, flip_quad(ao));
+}
+
+// Index of tint in the world palette, appended when missing. Meshers run
+// concurrently, callers avoid looking up the same block twice in a row
+uint16_t find_or_add_tint(World_t *world, glm::vec3 tint)
+{
+    const glm::vec3 rgb = glm::clamp(tint, 0.f, 1.f) * 255.f + 0.5f;
+    const uint32_t key = (uint32_t)rgb.r | (uint32_t)rgb.g << 8 | (uint32_t)rgb.b << 16;
+    std::lock_guard<std::mutex> lock(world->tints_mutex);
+    auto index = world->tint_indices.find(key);
+    if (index != world->tint_indices.end())
+        return index->second;
+    if (world->tints.size() >= TINT_PALETTE_SIZE)
+    {
+        printf("[ERROR] Tint palette is full\n");
+        return 0;
+    }
+    world->tints.push_back(key);
+    world->tint_indices[key] = world->tints.size() - 1;
+    return world->tints.size() - 1;
+}
+
+// Bit per face, see FACE_*
+enum Face
+{
+    FACE_TOP,
+    FACE_FRONT,
+    FACE_LEFT,
+    FACE_BACK,
+    FACE_RIGHT,
+    FACE_BOTTOM
+};
+
+// Per face: normal axis, direction, then the two axes of the face (width, height)
+// clang-format off
+const int32_t face_axes[6][4] = {
+    {2,  1, 0, 1}, // TOP
+    {1, -1, 0, 2}, // FRONT
+    {0, -1, 1, 2}, // LEFT
+    {1,  1, 0, 2}, // BACK
+    {0,  1, 1, 2}, // RIGHT
+    {2, -1, 0, 1}, // BOTTOM
+};
+
+// Per face: offset to the neighbor slice or block across it
+const int32_t face_neighbors[6][3] = {
+    { 0,  0,  1}, // TOP
+    { 0, -1,  0}, // FRONT
+    {-1,  0,  0}, // LEFT
+    { 0,  1,  0}, // BACK
+    { 1,  0,  0}, // RIGHT
+    { 0,  0, -1}, // BOTTOM
+};
+// clang-format on
+
+const uint8_t opposite_faces[6] = {FACE_BOTTOM, FACE_BACK, FACE_RIGHT, FACE_FRONT, FACE_LEFT, FACE_TOP};
+
+// Slice blocks with a one block border from the neighbors, in (x, y, z) order.
+// Coordinates are shifted by one, the slice spans 1 to 16 on each axis
+#define PADDED_SIZE 18
+#define PADDED_VOLUME (PADDED_SIZE * PADDED_SIZE * PADDED_SIZE)
+
+constexpr size_t padded_index(int32_t x, int32_t y, int32_t z)
+{
+    return x + PADDED_SIZE * (y + PADDED_SIZE * z);
+}
+
+// Resolves the palette of slice and of its neighbors once, missing neighbors are air
+void gather_padded_blocks(Slice_t *slice, Block_t **padded)
+{
+    for (int32_t dz = -1; dz <= 1; dz++)
+    {
+        for (int32_t dy = -1; dy <= 1; dy++)
+        {
+            for (int32_t dx = -1; dx <= 1; dx++)
+            {
+                Slice_t *source = dx == 0 && dy == 0 && dz == 0 ? slice : slice->neighbors[neighbor_index(dx, dy, dz)];
+                // Range covered in padded coordinates, and the matching source coordinate
+                const int32_t min[3] = {dx < 0 ? 0 : (dx > 0 ? 17 : 1), dy < 0 ? 0 : (dy > 0 ? 17 : 1), dz < 0 ? 0 : (dz > 0 ? 17 : 1)};
+                const int32_t max[3] = {dx == 0 ? 17 : min[0] + 1, dy == 0 ? 17 : min[1] + 1, dz == 0 ? 17 : min[2] + 1};
+                const int32_t shift[3] = {dx < 0 ? 16 : (dx > 0 ? -16 : 0), dy < 0 ? 16 : (dy > 0 ? -16 : 0), dz < 0 ? 16 : (dz > 0 ? -16 : 0)};
+                const size_t blocks_count = source == NULL ? 0 : source->table.size();
+                for (int32_t z = min[2]; z < max[2]; z++)
+                {
+                    for (int32_t y = min[1]; y < max[1]; y++)
+                    {
+                        Block_t **row = padded + padded_index(0, y, z);
+                        if (blocks_count == 0)
+                        {
+                            std::fill(row + min[0], row + max[0], &block_air);
+                        }
+                        else if (blocks_count == 1)
+                        {
+                            std::fill(row + min[0], row + max[0], &source->table[0]);
+                        }
+                        else
+                        {
+                            const uint16_t *blocks = source->blocks + block_index(0, y - 1 + shift[1], z - 1 + shift[2]);
+                            for (int32_t x = min[0]; x < max[0]; x++)
+                            {
+                                row[x] = &source->table[blocks[x - 1 + shift[0]]];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+inline int32_t lowest_bit(uint32_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// Faces of opaque blocks are visible through air and the other layers, the
+// faces of translucent blocks through air and cutout blocks. Cutout blocks
+// show all their faces as soon as they touch air, only their faces toward
+// translucent blocks otherwise. Rows are computed as 18 bits masks over the
+// padded x axis, shifted back to the slice at the end. Only the first size
+// blocks of each axis are meshed, see downsample_blocks
+void cull_faces(Block_t *const *padded, FaceMasks_t *masks, int32_t size = 16)
+{
+    const uint32_t size_mask = (1u << size) - 1;
+    uint32_t air[PADDED_SIZE][PADDED_SIZE];
+    uint32_t cutout[PADDED_SIZE][PADDED_SIZE];
+    uint32_t translucent[PADDED_SIZE][PADDED_SIZE];
+    const Block_t *layer_block = NULL;
+    RenderLayer layer = LAYER_OPAQUE;
+    for (int32_t z = 0; z < PADDED_SIZE; z++)
+    {
+        for (int32_t y = 0; y < PADDED_SIZE; y++)
+        {
+            Block_t *const *row = padded + padded_index(0, y, z);
+            uint32_t air_row = 0, cutout_row = 0, translucent_row = 0;
+            for (int32_t x = 0; x < PADDED_SIZE; x++)
+            {
+                // Rows are mostly runs of the same block
+                if (row[x] != layer_block)
+                {
+                    layer_block = row[x];
+                    layer = block_layer(layer_block->block_id);
+                }
+                air_row |= (uint32_t)(row[x]->block_id == 0) << x;
+                cutout_row |= (uint32_t)(layer == LAYER_CUTOUT) << x;
+                translucent_row |= (uint32_t)(layer == LAYER_TRANSLUCENT) << x;
+            }
+            air[z][y] = air_row;
+            cutout[z][y] = cutout_row;
+            translucent[z][y] = translucent_row;
+        }
+    }
+
+    for (int32_t z = 1; z <= 16; z++)
+    {
+        for (int32_t y = 1; y <= 16; y++)
+        {
+            const uint32_t opaque = ~(air[z][y] | cutout[z][y] | translucent[z][y]);
+            const uint32_t exposed_cutout = cutout[z][y] & (air[z][y] << 1 | air[z][y] >> 1 | air[z][y - 1] | air[z][y + 1] | air[z - 1][y] | air[z + 1][y]);
+            // Neighbors rows of each face, aligned with the block row
+            auto neighbors = [z, y](const uint32_t (*rows)[PADDED_SIZE], uint32_t *faces)
+            {
+                faces[FACE_TOP] = rows[z + 1][y];
+                faces[FACE_FRONT] = rows[z][y - 1];
+                faces[FACE_LEFT] = rows[z][y] << 1;
+                faces[FACE_BACK] = rows[z][y + 1];
+                faces[FACE_RIGHT] = rows[z][y] >> 1;
+                faces[FACE_BOTTOM] = rows[z - 1][y];
+            };
+            uint32_t neighbor_air[6], neighbor_cutout[6], neighbor_translucent[6];
+            neighbors(air, neighbor_air);
+            neighbors(cutout, neighbor_cutout);
+            neighbors(translucent, neighbor_translucent);
+            for (int32_t face = 0; face < 6; face++)
+            {
+                const uint32_t visible = (opaque & (neighbor_air[face] | neighbor_cutout[face] | neighbor_translucent[face])) |
+                                         (translucent[z][y] & (neighbor_air[face] | neighbor_cutout[face])) |
+                                         (cutout[z][y] & neighbor_translucent[face]) | exposed_cutout;
+                masks->rows[face][z - 1][y - 1] = y > size || z > size ? 0 : visible >> 1 & size_mask;
+            }
+        }
+    }
+}
+
+// Arenas of the calling thread, per RenderLayer
+MeshArena_t *thread_mesh_arenas()
+{
+    thread_local MeshArena_t arenas[LAYERS_COUNT];
+    return arenas;
+}
+
+MeshArena_t *block_arena(MeshArena_t *arenas, BlockId_t block_id)
+{
+    return &arenas[block_layer(block_id)];
+}
+
+// Empties arena, growing it to hold face_quads quads per face
+void reset_mesh_arena(MeshArena_t *arena, const uint32_t *face_quads)
+{
+    size_t vertices_count = 0;
+    for (int32_t face = 0; face < 6; face++)
+    {
+        arena->face_begin[face] = vertices_count;
+        arena->face_end[face] = vertices_count;
+        vertices_count += 4 * face_quads[face];
+    }
+    if (arena->vertices.size() < vertices_count)
+        arena->vertices.resize(vertices_count);
+}
+
+// Keeps at most this many buffers in the vertex pool, the rest is freed
+#define MAX_POOLED_VERTEX_BUFFERS 256
+
+// Makes vertices hold count vertices without growing, from a pooled buffer
+// when it is too small
+void reserve_pooled_vertices(World_t *world, std::vector<PackedVertex_t> *vertices, size_t count)
+{
+    if (vertices->capacity() >= count)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(world->vertex_pool_mutex);
+        std::vector<std::vector<PackedVertex_t>> &pool = world->vertex_pool;
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            if (pool[i].capacity() < count)
+                continue;
+            vertices->swap(pool[i]);
+            if (pool[i].capacity() == 0)
+            {
+                pool[i].swap(pool.back());
+                pool.pop_back();
+            }
+            break;
+        }
+    }
+    vertices->reserve(count);
+}
+
+// Packs the face ranges back to back
+void copy_mesh_arena(World_t *world, const MeshArena_t *arena, RenderMesh_t *mesh)
+{
+    size_t vertices_count = 0;
+    for (int32_t face = 0; face < 6; face++)
+        vertices_count += arena->face_end[face] - arena->face_begin[face];
+    mesh->vertices.clear();
+    reserve_pooled_vertices(world, &mesh->vertices, vertices_count);
+    uint32_t min[3] = {16, 16, 16}, max[3] = {0, 0, 0};
+    for (int32_t face = 0; face < 6; face++)
+    {
+        mesh->vertices.insert(mesh->vertices.end(), arena->vertices.begin() + arena->face_begin[face], arena->vertices.begin() + arena->face_end[face]);
+        mesh->face_quads[face] = (arena->face_end[face] - arena->face_begin[face]) / 4;
+        for (size_t i = arena->face_begin[face]; i < arena->face_end[face]; i++)
+        {
+            const uint32_t packed = arena->vertices[i].position_face;
+            for (int32_t axis = 0; axis < 3; axis++)
+            {
+                const uint32_t position = packed >> 5 * axis & 31;
+                min[axis] = std::min(min[axis], position);
+                max[axis] = std::max(max[axis], position);
+            }
+        }
+    }
+    mesh->bounds_min = mesh->vertices.empty() ? glm::vec3(16.f) : glm::vec3(min[0], min[1], min[2]);
+    mesh->bounds_max = mesh->vertices.empty() ? glm::vec3(0.f) : glm::vec3(max[0], max[1], max[2]);
+}
+
+// Once uploaded the GPU copy is enough, except for translucent meshes which
+// are sorted again on the CPU. The buffer goes back to the pool
+void release_mesh_vertices(World_t *world, RenderMesh_t *mesh)
+{
+    std::vector<PackedVertex_t> vertices;
+    vertices.swap(mesh->vertices);
+    if (vertices.capacity() == 0)
+        return;
+    vertices.clear();
+    std::lock_guard<std::mutex> lock(world->vertex_pool_mutex);
+    if (world->vertex_pool.size() < MAX_POOLED_VERTEX_BUFFERS)
+        world->vertex_pool.push_back(std::move(vertices));
+}
+
+#define MIN_OCCLUDER_AREA 4
+#define MAX_SLICE_OCCLUDERS 64
+
+inline uint32_t occluder_area(const Occluder_t &occluder)
+{
+    uint32_t area = 1;
+    for (int32_t axis = 0; axis < 3; axis++)
+    {
+        area *= std::max(1, occluder.max[axis] - occluder.min[axis]);
+    }
+    return area;
+}
+
+// Visible faces of opaque blocks merged into rectangles whatever the blocks,
+// the largest hide what's behind them from the occlusion culling (see
+// culling.h). Small ones rarely cover a pixel of it
+void find_occluders(Block_t *const *padded, const FaceMasks_t *masks, std::vector<Occluder_t> *occluders, int32_t size = 16, int32_t scale = 1)
+{
+    occluders->clear();
+    uint32_t opaque[16][16];
+    for (int32_t z = 0; z < size; z++)
+    {
+        for (int32_t y = 0; y < size; y++)
+        {
+            opaque[z][y] = 0;
+            Block_t *const *blocks = padded + padded_index(1, y + 1, z + 1);
+            for (int32_t x = 0; x < size; x++)
+            {
+                opaque[z][y] |= (uint32_t)(blocks[x]->block_id != 0 && block_layer(blocks[x]->block_id) == LAYER_OPAQUE) << x;
+            }
+        }
+    }
+    uint32_t rows[16];
+    for (int32_t face = 0; face < 6; face++)
+    {
+        const int32_t axis = face_axes[face][0];
+        const int32_t u_axis = face_axes[face][2];
+        const int32_t v_axis = face_axes[face][3];
+        // Quads lie on the far side of the blocks of faces pointing up the axis
+        const int32_t offset = face_axes[face][1] > 0 ? 1 : 0;
+        for (int32_t layer = 0; layer < size; layer++)
+        {
+            for (int32_t v = 0; v < size; v++)
+            {
+                rows[v] = 0;
+                if (axis == 2)
+                    rows[v] = masks->rows[face][layer][v] & opaque[layer][v];
+                else if (axis == 1)
+                    rows[v] = masks->rows[face][v][layer] & opaque[v][layer];
+                else
+                {
+                    for (int32_t u = 0; u < size; u++)
+                    {
+                        rows[v] |= ((masks->rows[face][v][u] & opaque[v][u]) >> layer & 1) << u;
+                    }
+                }
+            }
+            for (int32_t v = 0; v < size; v++)
+            {
+                while (rows[v] != 0)
+                {
+                    const int32_t u = lowest_bit(rows[v]);
+                    const int32_t width = lowest_bit(~(rows[v] >> u));
+                    const uint32_t span = ((1u << width) - 1) << u;
+                    int32_t height = 1;
+                    while (v + height < size && (rows[v + height] & span) == span)
+                    {
+                        height++;
+                    }
+                    for (int32_t i = v; i < v + height; i++)
+                    {
+                        rows[i] &= ~span;
+                    }
+                    if (width * height * scale * scale < MIN_OCCLUDER_AREA)
+                        continue;
+                    Occluder_t occluder;
+                    occluder.min[axis] = occluder.max[axis] = (layer + offset) * scale;
+                    occluder.min[u_axis] = u * scale;
+                    occluder.max[u_axis] = (u + width) * scale;
+                    occluder.min[v_axis] = v * scale;
+                    occluder.max[v_axis] = (v + height) * scale;
+                    occluders->push_back(occluder);
+                }
+            }
+        }
+    }
+    if (occluders->size() > MAX_SLICE_OCCLUDERS)
+    {
+        std::nth_element(occluders->begin(), occluders->begin() + MAX_SLICE_OCCLUDERS, occluders->end(), [](const Occluder_t &a, const Occluder_t &b)
+                         { return occluder_area(a) > occluder_area(b); });
+        occluders->resize(MAX_SLICE_OCCLUDERS);
+    }
+}
+
+// Visible faces per face, returns the total
+uint32_t count_faces(const FaceMasks_t *masks, uint32_t *face_counts)
+{
+    uint32_t count = 0;
+    for (int32_t face = 0; face < 6; face++)
+    {
+        face_counts[face] = 0;
+        for (int32_t z = 0; z < 16; z++)
+        {
+            for (int32_t y = 0; y < 16; y++)
+            {
+                for (uint32_t bits = masks->rows[face][z][y]; bits != 0; bits &= bits - 1)
+                {
+                    face_counts[face]++;
+                }
+            }
+        }
+        count += face_counts[face];
+    }
+    return count;
+}
+
+// Occlusion of the face of the padded block (x, y, z) from the blocks in front
+// of it: the two sides and the corner around each of its corners
+uint8_t face_ao(Block_t *const *padded, int32_t face, int32_t x, int32_t y, int32_t z)
+{
+    const int32_t u_axis = face_axes[face][2];
+    const int32_t v_axis = face_axes[face][3];
+    int32_t front[3] = {x, y, z};
+    front[face_axes[face][0]] += face_axes[face][1];
+    auto solid = [&](int32_t du, int32_t dv)
+    {
+        int32_t position[3] = {front[0], front[1], front[2]};
+        position[u_axis] += du;
+        position[v_axis] += dv;
+        return (uint32_t)(padded[padded_index(position[0], position[1], position[2])]->block_id != 0);
+    };
+    const int32_t corners[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+    uint8_t ao = 0;
+    for (int32_t corner = 0; corner < 4; corner++)
+    {
+        const uint32_t side_u = solid(corners[corner][0], 0);
+        const uint32_t side_v = solid(0, corners[corner][1]);
+        const uint32_t occlusion = side_u && side_v ? 3 : side_u + side_v + solid(corners[corner][0], corners[corner][1]);
+        ao |= (3 - occlusion) << 2 * corner;
+    }
+    return ao;
+}
+
+// A quad per visible face
+void emit_faces(World_t *world, Block_t *const *padded, const FaceMasks_t *masks, MeshArena_t *arenas)
+{
+    const Block_t *tinted_block = NULL;
+    uint16_t tint = 0;
+    for (size_t z = 0; z < 16; z++)
+    {
+        for (size_t y = 0; y < 16; y++)
+        {
+            uint32_t visible = 0;
+            for (int32_t face = 0; face < 6; face++)
+            {
+                visible |= masks->rows[face][z][y];
+            }
+            for (; visible != 0; visible &= visible - 1)
+            {
+                const int32_t x = lowest_bit(visible);
+                uint8_t faces = 0;
+                for (int32_t face = 0; face < 6; face++)
+                {
+                    faces |= (masks->rows[face][z][y] >> x & 1) << face;
+                }
+                Block_t *current_block = padded[padded_index(x + 1, y + 1, z + 1)];
+                BlockId_t current_block_id = current_block->block_id;
+                MeshArena_t *arena = block_arena(arenas, current_block_id);
+                if (current_block != tinted_block)
+                {
+                    tint = find_or_add_tint(world, current_block->tint);
+                    tinted_block = current_block;
+                }
+
+                if (faces & 1 << FACE_LEFT)
+                {
+                    add_face_x(arena, x, y, z, -1, current_block_id, tint, 1, 1, face_ao(padded, FACE_LEFT, x + 1, y + 1, z + 1));
+                }
+                if (faces & 1 << FACE_RIGHT)
+                {
+                    add_face_x(arena, x + 1, y, z, 1, current_block_id, tint, 1, 1, face_ao(padded, FACE_RIGHT, x + 1, y + 1, z + 1));
+                }
+                if (faces & 1 << FACE_FRONT)
+                {
+                    add_face_y(arena, x, y, z, -1, current_block_id, tint, 1, 1, face_ao(padded, FACE_FRONT, x + 1, y + 1, z + 1));
+                }
+                if (faces & 1 << FACE_BACK)
+                {
+                    add_face_y(arena, x, y + 1, z, 1, current_block_id, tint, 1, 1, face_ao(padded, FACE_BACK, x + 1, y + 1, z + 1));
+                }
+                if (faces & 1 << FACE_BOTTOM)
+                {
+                    add_face_z(arena, x, y, z, -1, current_block_id, tint, 1, 1, face_ao(padded, FACE_BOTTOM, x + 1, y + 1, z + 1));
+                }
+                if (faces & 1 << FACE_TOP)
+                {
+                    add_face_z(arena, x, y, z + 1, 1, current_block_id, tint, 1, 1, face_ao(padded, FACE_TOP, x + 1, y + 1, z + 1));
+                }
+            }
+        }
+    }
+}
+
+// Merges the visible faces of each layer into rectangles of identical blocks.
+// Blocks are scale wide, size blocks per axis
+void emit_greedy_faces(World_t *world, Block_t *const *padded, const FaceMasks_t *masks, MeshArena_t *arenas, int32_t size = 16, int32_t scale = 1)
+{
+    const Block_t *tinted_block = NULL;
+    uint16_t tint = 0;
+    Block_t *mask[16 * 16];
+    uint8_t mask_ao[16 * 16];
+    for (int32_t face = 0; face < 6; face++)
+    {
+        const int32_t axis = face_axes[face][0];
+        const int32_t direction = face_axes[face][1];
+        const int32_t u_axis = face_axes[face][2];
+        const int32_t v_axis = face_axes[face][3];
+        for (int32_t layer = 0; layer < size; layer++)
+        {
+            int32_t position[3];
+            position[axis] = layer;
+            bool empty = true;
+            std::fill(mask, mask + 16 * 16, nullptr);
+            for (int32_t v = 0; v < size; v++)
+            {
+                // Visible faces of the layer row v, a bit per u
+                uint32_t row = 0;
+                if (axis == 2)
+                    row = masks->rows[face][layer][v];
+                else if (axis == 1)
+                    row = masks->rows[face][v][layer];
+                else
+                {
+                    for (int32_t u = 0; u < size; u++)
+                    {
+                        row |= (masks->rows[face][v][u] >> layer & 1) << u;
+                    }
+                }
+                empty &= row == 0;
+                position[v_axis] = v;
+                for (; row != 0; row &= row - 1)
+                {
+                    const int32_t u = lowest_bit(row);
+                    position[u_axis] = u;
+                    mask[u + 16 * v] = padded[padded_index(position[0] + 1, position[1] + 1, position[2] + 1)];
+                    mask_ao[u + 16 * v] = face_ao(padded, face, position[0] + 1, position[1] + 1, position[2] + 1);
+                }
+            }
+            if (empty)
+                continue;
+
+            for (int32_t v = 0; v < size; v++)
+            {
+                for (int32_t u = 0; u < size;)
+                {
+                    Block_t *block = mask[u + 16 * v];
+                    if (block == NULL)
+                    {
+                        u++;
+                        continue;
+                    }
+                    const uint8_t ao = mask_ao[u + 16 * v];
+                    // Faces with the same occlusion interpolate the same across the merged quad
+                    auto same = [&](size_t i)
+                    { return mask[i] != NULL && mask[i]->block_id == block->block_id && mask[i]->tint == block->tint && mask_ao[i] == ao; };
+                    int32_t width = 1;
+                    while (u + width < size && same(u + width + 16 * v))
+                    {
+                        width++;
+                    }
+                    int32_t height = 1;
+                    for (; v + height < size; height++)
+                    {
+                        bool full = true;
+                        for (int32_t i = 0; i < width && full; i++)
+                        {
+                            full = same(u + i + 16 * (v + height));
+                        }
+                        if (!full)
+                            break;
+                    }
+                    for (int32_t j = 0; j < height; j++)
+                    {
+                        std::fill(mask + u + 16 * (v + j), mask + u + width + 16 * (v + j), nullptr);
+                    }
+
+                    position[u_axis] = u;
+                    position[v_axis] = v;
+                    const uint32_t x = scale * (position[0] + (axis == 0 && direction > 0 ? 1 : 0));
+                    const uint32_t y = scale * (position[1] + (axis == 1 && direction > 0 ? 1 : 0));
+                    const uint32_t z = scale * (position[2] + (axis == 2 && direction > 0 ? 1 : 0));
+                    if (block != tinted_block)
+                    {
+                        tint = find_or_add_tint(world, block->tint);
+                        tinted_block = block;
+                    }
+                    MeshArena_t *arena = block_arena(arenas, block->block_id);
+                    if (axis == 0)
+                        add_face_x(arena, x, y, z, direction, block->block_id, tint, scale * width, scale * height, ao);
+                    else if (axis == 1)
+                        add_face_y(arena, x, y, z, direction, block->block_id, tint, scale * width, scale * height, ao);
+                    else
+                        add_face_z(arena, x, y, z, direction, block->block_id, tint, scale * width, scale * height, ao);
+                    u += width;
+                }
+            }
+        }
+    }
+}
+
+// Reduces padded to cells of 2^lod blocks, keeping the one cell border: the
+// cells of the slice span 1 to size, the border is made of the single block
+// layers of the neighbors. A cell is the most common block of its blocks when
+// at least half are not air, air otherwise. Unused cells are air
+void downsample_blocks(Block_t *const *padded, uint8_t lod, Block_t **reduced)
+{
+    const int32_t scale = 1 << lod;
+    const int32_t size = 16 >> lod;
+    std::fill(reduced, reduced + PADDED_VOLUME, &block_air);
+    // Padded range of each cell along an axis
+    int32_t begin[PADDED_SIZE], end[PADDED_SIZE];
+    begin[0] = 0;
+    end[0] = 1;
+    for (int32_t i = 1; i <= size; i++)
+    {
+        begin[i] = 1 + (i - 1) * scale;
+        end[i] = begin[i] + scale;
+    }
+    begin[size + 1] = PADDED_SIZE - 1;
+    end[size + 1] = PADDED_SIZE;
+
+    Block_t *candidates[64];
+    uint32_t counts[64];
+    for (int32_t z = 0; z <= size + 1; z++)
+    {
+        for (int32_t y = 0; y <= size + 1; y++)
+        {
+            for (int32_t x = 0; x <= size + 1; x++)
+            {
+                size_t candidates_count = 0;
+                uint32_t total = 0, solid = 0;
+                for (int32_t bz = begin[z]; bz < end[z]; bz++)
+                {
+                    for (int32_t by = begin[y]; by < end[y]; by++)
+                    {
+                        for (int32_t bx = begin[x]; bx < end[x]; bx++)
+                        {
+                            Block_t *block = padded[padded_index(bx, by, bz)];
+                            total++;
+                            if (block->block_id == 0)
+                                continue;
+                            solid++;
+                            size_t i = 0;
+                            while (i < candidates_count && candidates[i] != block)
+                            {
+                                i++;
+                            }
+                            if (i == candidates_count)
+                            {
+                                candidates[candidates_count++] = block;
+                                counts[i] = 0;
+                            }
+                            counts[i]++;
+                        }
+                    }
+                }
+                if (solid == 0 || 2 * solid < total)
+                    continue;
+                size_t best = 0;
+                for (size_t i = 1; i < candidates_count; i++)
+                {
+                    if (counts[i] > counts[best])
+                        best = i;
+                }
+                reduced[padded_index(x, y, z)] = candidates[best];
+            }
+        }
+    }
+}
+
+// Shows the faces of the slice boundary toward neighbors at another lod, they
+// close the cracks between the two resolutions
+void add_skirts(Block_t *const *padded, FaceMasks_t *masks, int32_t size, uint8_t skirts)
+{
+    if (skirts == 0)
+        return;
+    for (int32_t z = 0; z < size; z++)
+    {
+        for (int32_t y = 0; y < size; y++)
+        {
+            uint32_t row = 0;
+            Block_t *const *blocks = padded + padded_index(1, y + 1, z + 1);
+            for (int32_t x = 0; x < size; x++)
+            {
+                row |= (uint32_t)(blocks[x]->block_id != 0) << x;
+            }
+            if (skirts & 1 << FACE_LEFT)
+                masks->rows[FACE_LEFT][z][y] |= row & 1;
+            if (skirts & 1 << FACE_RIGHT)
+                masks->rows[FACE_RIGHT][z][y] |= row & 1u << (size - 1);
+            if (skirts & 1 << FACE_FRONT && y == 0)
+                masks->rows[FACE_FRONT][z][y] |= row;
+            if (skirts & 1 << FACE_BACK && y == size - 1)
+                masks->rows[FACE_BACK][z][y] |= row;
+            if (skirts & 1 << FACE_BOTTOM && z == 0)
+                masks->rows[FACE_BOTTOM][z][y] |= row;
+            if (skirts & 1 << FACE_TOP && z == size - 1)
+                masks->rows[FACE_TOP][z][y] |= row;
+        }
+    }
+}
+
+// Writes the slice render meshes and its occluders when asked, returns the
+// visible faces count
+uint32_t generate_mesh(World_t *world, Slice_t *slice, MeshSettings_t settings, std::vector<Occluder_t> *occluders = NULL)
+{
+    Block_t *padded[PADDED_VOLUME];
+    gather_padded_blocks(slice, padded);
+    Block_t *reduced[PADDED_VOLUME];
+    Block_t **blocks = padded;
+    const int32_t size = 16 >> settings.lod;
+    if (settings.lod > 0)
+    {
+        downsample_blocks(padded, settings.lod, reduced);
+        blocks = reduced;
+    }
+    FaceMasks_t masks;
+    cull_faces(blocks, &masks, size);
+    add_skirts(blocks, &masks, size, settings.skirts);
+    if (occluders != NULL)
+        find_occluders(blocks, &masks, occluders, size, 1 << settings.lod);
+
+    // Each visible face is a quad, which bounds both meshes
+    uint32_t face_counts[6];
+    const uint32_t faces_count = count_faces(&masks, face_counts);
+    MeshArena_t *arenas = thread_mesh_arenas();
+    for (int32_t layer = 0; layer < LAYERS_COUNT; layer++)
+    {
+        reset_mesh_arena(&arenas[layer], face_counts);
+    }
+    if (settings.greedy || settings.lod > 0)
+        emit_greedy_faces(world, blocks, &masks, arenas, size, 1 << settings.lod);
+    else
+        emit_faces(world, blocks, &masks, arenas);
+    for (int32_t layer = 0; layer < LAYERS_COUNT; layer++)
+    {
+        copy_mesh_arena(world, &arenas[layer], &slice->meshes[layer]);
+    }
+    return faces_count;
+}
+
+// Faces of the slice a block on the boundary of, a bit per face
+inline uint8_t boundary_faces(int32_t x, int32_t y, int32_t z)
+{
+    return (z == 15) << FACE_TOP | (y == 0) << FACE_FRONT | (x == 0) << FACE_LEFT |
+           (y == 15) << FACE_BACK | (x == 15) << FACE_RIGHT | (z == 0) << FACE_BOTTOM;
+}
+
+// Writes, for each face of the slice, the faces it sees through the blocks which
+// aren't in the opaque layer, a bit per face (see FACE_*). Every open region
+// touching the boundary is flood filled, the faces it touches connect
+void slice_face_connections(const Slice_t *slice, uint8_t connections[6])
+{
+    std::vector<bool> open(slice->table.size());
+    size_t open_count = 0;
+    for (size_t i = 0; i < slice->table.size(); i++)
+    {
+        const BlockId_t block_id = slice->table[i].block_id;
+        open[i] = block_id == 0 || block_layer(block_id) != LAYER_OPAQUE;
+        open_count += open[i];
+    }
+    if (open_count == slice->table.size() || open_count == 0)
+    {
+        std::fill(connections, connections + 6, open_count == 0 ? 0 : 0x3F);
+        return;
+    }
+
+    std::fill(connections, connections + 6, 0);
+    std::vector<bool> visited(4096);
+    uint16_t stack[4096];
+    for (int32_t start = 0; start < 4096; start++)
+    {
+        if (visited[start] || !open[slice->blocks[start]] || boundary_faces(start & 15, start >> 4 & 15, start >> 8) == 0)
+            continue;
+        uint8_t faces = 0;
+        size_t stack_size = 0;
+        stack[stack_size++] = start;
+        visited[start] = true;
+        while (stack_size > 0)
+        {
+            const int32_t index = stack[--stack_size];
+            const int32_t position[3] = {index & 15, index >> 4 & 15, index >> 8};
+            faces |= boundary_faces(position[0], position[1], position[2]);
+            for (int32_t face = 0; face < 6; face++)
+            {
+                const int32_t axis = face_axes[face][0];
+                const int32_t next = position[axis] + face_axes[face][1];
+                if (next < 0 || next > 15)
+                    continue;
+                const int32_t neighbor = index + face_axes[face][1] * (1 << 4 * axis);
+                if (visited[neighbor] || !open[slice->blocks[neighbor]])
+                    continue;
+                visited[neighbor] = true;
+                stack[stack_size++] = neighbor;
+            }
+        }
+        for (int32_t face = 0; face < 6; face++)
+        {
+            if (faces & 1 << face)
+                connections[face] |= faces;
+        }
+    }
+}
+
+// Orders the quads of mesh from the farthest to the closest to viewer, local
+// to the slice. The face ranges don't hold anymore, the mesh is drawn whole
+void sort_quads_back_to_front(RenderMesh_t *mesh, glm::vec3 viewer)
+{
+    const size_t quads_count = mesh->vertices.size() / 4;
+    if (quads_count < 2)
+        return;
+    // Compared on 4 times the quads centers
+    std::vector<std::pair<float, uint32_t>> distances(quads_count);
+    for (size_t quad = 0; quad < quads_count; quad++)
+    {
+        glm::vec3 center = glm::vec3(0.f);
+        for (size_t i = 0; i < 4; i++)
+        {
+            const uint32_t packed = mesh->vertices[4 * quad + i].position_face;
+            center += glm::vec3(packed & 31, packed >> 5 & 31, packed >> 10 & 31);
+        }
+        const glm::vec3 offset = center - 4.f * viewer;
+        distances[quad] = {glm::dot(offset, offset), (uint32_t)quad};
+    }
+    std::sort(distances.begin(), distances.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b)
+              { return a.first > b.first; });
+    std::vector<PackedVertex_t> sorted(mesh->vertices.size());
+    for (size_t quad = 0; quad < quads_count; quad++)
+    {
+        std::copy_n(mesh->vertices.begin() + 4 * distances[quad].second, 4, sorted.begin() + 4 * quad);
+    }
+    mesh->vertices.swap(sorted);
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef NOISE_GRAPH_H
+#define NOISE_GRAPH_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <utility>
+#include "generation.h"
+
+// Noise graph, loaded from a config file (see resources/terrain.noise)
+//
+//   # comment
+//   name = type args...
+//
+// Each line defines a node from constants and previously defined nodes,
+// the last node is the output of the graph. Node types:
+//   constant <value>
+//   fbm      octaves= frequency= lacunarity= gain= amplitude= offset= seed= warp_x=<node> warp_y=<node>
+//   ridged   (same keys as fbm)
+//   add      <node> <node>
+//   mul      <node> <node>
+//   spline   <node> x:y x:y ...
+//   clamp    <node> <min> <max>
+//
+// The graph is compiled into a flat register program: op i writes register i
+// and only reads registers < i. Octave loops are template kernels instantiated
+// for every octave count so they fully unroll.
+
+#define NOISE_MAX_NODES 32
+#define NOISE_MAX_OCTAVES 8
+#define NOISE_MAX_SPLINE_POINTS 8
+#define NOISE_MAX_NAME 32
+
+enum NoiseOpCode
+{
+    NOISE_CONSTANT,
+    NOISE_FBM,
+    NOISE_RIDGED,
+    NOISE_ADD,
+    NOISE_MUL,
+    NOISE_SPLINE,
+    NOISE_CLAMP
+};
+
+struct NoiseOp;
+typedef float (*NoiseKernel_t)(const NoiseOp *op, float x, float y);
+
+typedef struct NoiseOp
+{
+    NoiseOpCode code;
+    NoiseKernel_t kernel; // fbm and ridged only
+    int8_t inputs[2];
+    int8_t warp_x;
+    int8_t warp_y;
+    uint8_t octaves;
+    int seed;
+    float value; // constant value, or offset added to the kernel output
+    float frequencies[NOISE_MAX_OCTAVES];
+    float amplitudes[NOISE_MAX_OCTAVES];
+    float min;
+    float max;
+    uint8_t spline_count;
+    float spline_x[NOISE_MAX_SPLINE_POINTS];
+    float spline_y[NOISE_MAX_SPLINE_POINTS];
+} NoiseOp_t;
+
+typedef struct NoiseProgram
+{
+    size_t count;
+    NoiseOp_t ops[NOISE_MAX_NODES];
+} NoiseProgram_t;
+
+// Kernels
+
+template <size_t Octave>
+inline float fbm_octave(const NoiseOp_t *op, float x, float y)
+{
+    const float freq = op->frequencies[Octave];
+    return op->amplitudes[Octave] * stb_perlin_noise3_seed(freq * x, freq * y, 0.f, 0, 0, 0, op->seed);
+}
+
+template <size_t... Octaves>
+inline float fbm_sum(const NoiseOp_t *op, float x, float y, std::index_sequence<Octaves...>)
+{
+    return (0.f + ... + fbm_octave<Octaves>(op, x, y));
+}
+
+template <size_t Octaves>
+float fbm_kernel(const NoiseOp_t *op, float x, float y)
+{
+    return fbm_sum(op, x, y, std::make_index_sequence<Octaves>{}) + op->value;
+}
+
+// Ridged octaves are weighted by the previous one, as in stb_perlin_ridge_noise3
+template <size_t Octave>
+inline float ridged_octave(const NoiseOp_t *op, float x, float y, float *prev)
+{
+    const float freq = op->frequencies[Octave];
+    float r = 1.f - fabsf(stb_perlin_noise3_seed(freq * x, freq * y, 0.f, 0, 0, 0, op->seed));
+    r = r * r;
+    const float val = op->amplitudes[Octave] * r * *prev;
+    *prev = r;
+    return val;
+}
+
+template <size_t... Octaves>
+inline float ridged_sum(const NoiseOp_t *op, float x, float y, std::index_sequence<Octaves...>)
+{
+    float prev = 1.f;
+    float sum = 0.f;
+    ((sum += ridged_octave<Octaves>(op, x, y, &prev)), ...);
+    return sum;
+}
+
+template <size_t Octaves>
+float ridged_kernel(const NoiseOp_t *op, float x, float y)
+{
+    return ridged_sum(op, x, y, std::make_index_sequence<Octaves>{}) + op->value;
+}
+
+static const NoiseKernel_t fbm_kernels[NOISE_MAX_OCTAVES] = {
+    fbm_kernel<1>, fbm_kernel<2>, fbm_kernel<3>, fbm_kernel<4>,
+    fbm_kernel<5>, fbm_kernel<6>, fbm_kernel<7>, fbm_kernel<8>};
+
+static const NoiseKernel_t ridged_kernels[NOISE_MAX_OCTAVES] = {
+    ridged_kernel<1>, ridged_kernel<2>, ridged_kernel<3>, ridged_kernel<4>,
+    ridged_kernel<5>, ridged_kernel<6>, ridged_kernel<7>, ridged_kernel<8>};
+
+float evaluate_spline(const NoiseOp_t *op, float x)
+{
+    if (x <= op->spline_x[0])
+        return op->spline_y[0];
+    for (uint8_t i = 1; i < op->spline_count; i++)
+    {
+        if (x < op->spline_x[i])
+        {
+            const float t = (x - op->spline_x[i - 1]) / (op->spline_x[i] - op->spline_x[i - 1]);
+            return op->spline_y[i - 1] + t * (op->spline_y[i] - op->spline_y[i - 1]);
+        }
+    }
+    return op->spline_y[op->spline_count - 1];
+}
+
+float sample_noise(const NoiseProgram_t *program, float x, float y)
+{
+    float registers[NOISE_MAX_NODES];
+    for (size_t i = 0; i < program->count; i++)
+    {
+        const NoiseOp_t *op = &program->ops[i];
+        switch (op->code)
+        {
+        case NOISE_CONSTANT:
+            registers[i] = op->value;
+            break;
+        case NOISE_FBM:
+        case NOISE_RIDGED:
+        {
+            const float sample_x = op->warp_x >= 0 ? x + registers[op->warp_x] : x;
+            const float sample_y = op->warp_y >= 0 ? y + registers[op->warp_y] : y;
+            registers[i] = op->kernel(op, sample_x, sample_y);
+            break;
+        }
+        case NOISE_ADD:
+            registers[i] = registers[op->inputs[0]] + registers[op->inputs[1]];
+            break;
+        case NOISE_MUL:
+            registers[i] = registers[op->inputs[0]] * registers[op->inputs[1]];
+            break;
+        case NOISE_SPLINE:
+            registers[i] = evaluate_spline(op, registers[op->inputs[0]]);
+            break;
+        case NOISE_CLAMP:
+        {
+            const float val = registers[op->inputs[0]];
+            registers[i] = val < op->min ? op->min : (val > op->max ? op->max : val);
+            break;
+        }
+        }
+    }
+    return program->count > 0 ? registers[program->count - 1] : 0.f;
+}
+
+// Compiler
+
+int find_noise_node(char names[][NOISE_MAX_NAME], size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+bool parse_noise_number(const char *token, float *value)
+{
+    char *end;
+    *value = strtof(token, &end);
+    return end != token && *end == '\0';
+}
+
+bool compile_noise_line(NoiseOp_t *op, char names[][NOISE_MAX_NAME], size_t count, char *type, char *args, size_t line_number)
+{
+    float frequency = 1.f;
+    float lacunarity = 2.f;
+    float gain = 0.5f;
+    float amplitude = 1.f;
+    size_t positional = 0;
+
+    op->inputs[0] = -1;
+    op->inputs[1] = -1;
+    op->warp_x = -1;
+    op->warp_y = -1;
+    op->octaves = 1;
+
+    if (strcmp(type, "constant") == 0)
+        op->code = NOISE_CONSTANT;
+    else if (strcmp(type, "fbm") == 0)
+        op->code = NOISE_FBM;
+    else if (strcmp(type, "ridged") == 0)
+        op->code = NOISE_RIDGED;
+    else if (strcmp(type, "add") == 0)
+        op->code = NOISE_ADD;
+    else if (strcmp(type, "mul") == 0)
+        op->code = NOISE_MUL;
+    else if (strcmp(type, "spline") == 0)
+        op->code = NOISE_SPLINE;
+    else if (strcmp(type, "clamp") == 0)
+        op->code = NOISE_CLAMP;
+    else
+    {
+        printf("[ERROR] Noise graph line %zu: unknown node type '%s'\n", line_number, type);
+        return false;
+    }
+
+    for (char *token = strtok(args, " \t"); token != NULL; token = strtok(NULL, " \t"))
+    {
+        char *separator = strchr(token, '=');
+        if (separator != NULL)
+        {
+            *separator = '\0';
+            const char *key = token;
+            const char *val = separator + 1;
+            float number = 0.f;
+            if (strcmp(key, "warp_x") == 0 || strcmp(key, "warp_y") == 0)
+            {
+                int input = find_noise_node(names, count, val);
+                if (input < 0)
+                {
+                    printf("[ERROR] Noise graph line %zu: unknown node '%s'\n", line_number, val);
+                    return false;
+                }
+                (key[5] == 'x' ? op->warp_x : op->warp_y) = input;
+                continue;
+            }
+            if (!parse_noise_number(val, &number))
+            {
+                printf("[ERROR] Noise graph line %zu: invalid value for '%s'\n", line_number, key);
+                return false;
+            }
+            if (strcmp(key, "octaves") == 0)
+            {
+                if (number < 1 || number > NOISE_MAX_OCTAVES)
+                {
+                    printf("[ERROR] Noise graph line %zu: octaves must be within [1, %i]\n", line_number, NOISE_MAX_OCTAVES);
+                    return false;
+                }
+                op->octaves = (uint8_t)number;
+            }
+            else if (strcmp(key, "frequency") == 0)
+                frequency = number;
+            else if (strcmp(key, "lacunarity") == 0)
+                lacunarity = number;
+            else if (strcmp(key, "gain") == 0)
+                gain = number;
+            else if (strcmp(key, "amplitude") == 0)
+                amplitude = number;
+            else if (strcmp(key, "offset") == 0)
+                op->value = number;
+            else if (strcmp(key, "seed") == 0)
+                op->seed = (int)number;
+            else
+            {
+                printf("[ERROR] Noise graph line %zu: unknown key '%s'\n", line_number, key);
+                return false;
+            }
+            continue;
+        }
+
+        char *colon = strchr(token, ':');
+        if (op->code == NOISE_SPLINE && colon != NULL)
+        {
+            *colon = '\0';
+            if (op->spline_count >= NOISE_MAX_SPLINE_POINTS)
+            {
+                printf("[ERROR] Noise graph line %zu: too many spline points\n", line_number);
+                return false;
+            }
+            if (!parse_noise_number(token, &op->spline_x[op->spline_count]) ||
+                !parse_noise_number(colon + 1, &op->spline_y[op->spline_count]) ||
+                (op->spline_count > 0 && op->spline_x[op->spline_count] <= op->spline_x[op->spline_count - 1]))
+            {
+                printf("[ERROR] Noise graph line %zu: spline points must be increasing x:y pairs\n", line_number);
+                return false;
+            }
+            op->spline_count++;
+            continue;
+        }
+
+        float number = 0.f;
+        if (op->code == NOISE_CONSTANT && positional == 0 && parse_noise_number(token, &number))
+            op->value = number;
+        else if (op->code == NOISE_CLAMP && positional == 1 && parse_noise_number(token, &number))
+            op->min = number;
+        else if (op->code == NOISE_CLAMP && positional == 2 && parse_noise_number(token, &number))
+            op->max = number;
+        else if (positional < 2)
+        {
+            int input = find_noise_node(names, count, token);
+            if (input < 0)
+            {
+                printf("[ERROR] Noise graph line %zu: unknown node '%s'\n", line_number, token);
+                return false;
+            }
+            op->inputs[positional] = input;
+        }
+        else
+        {
+            printf("[ERROR] Noise graph line %zu: unexpected argument '%s'\n", line_number, token);
+            return false;
+        }
+        positional++;
+    }
+
+    switch (op->code)
+    {
+    case NOISE_FBM:
+    case NOISE_RIDGED:
+        for (uint8_t octave = 0; octave < op->octaves; octave++)
+        {
+            op->frequencies[octave] = frequency;
+            op->amplitudes[octave] = amplitude;
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+        op->kernel = op->code == NOISE_FBM ? fbm_kernels[op->octaves - 1] : ridged_kernels[op->octaves - 1];
+        break;
+    case NOISE_ADD:
+    case NOISE_MUL:
+        if (op->inputs[0] < 0 || op->inputs[1] < 0)
+        {
+            printf("[ERROR] Noise graph line %zu: '%s' takes two nodes\n", line_number, type);
+            return false;
+        }
+        break;
+    case NOISE_SPLINE:
+        if (op->inputs[0] < 0 || op->spline_count == 0)
+        {
+            printf("[ERROR] Noise graph line %zu: spline takes a node and at least one point\n", line_number);
+            return false;
+        }
+        break;
+    case NOISE_CLAMP:
+        if (op->inputs[0] < 0 || positional != 3 || op->min > op->max)
+        {
+            printf("[ERROR] Noise graph line %zu: clamp takes a node, a min and a max\n", line_number);
+            return false;
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+// Compiles a graph source into program, returns false (leaving program empty) on error
+bool compile_noise_graph(NoiseProgram_t *program, const char *source)
+{
+    char names[NOISE_MAX_NODES][NOISE_MAX_NAME];
+    char line[256];
+    size_t line_number = 0;
+
+    *program = {};
+    const char *cursor = source;
+    while (*cursor != '\0')
+    {
+        size_t length = strcspn(cursor, "\r\n");
+        line_number++;
+        if (length >= sizeof(line))
+        {
+            printf("[ERROR] Noise graph line %zu: line too long\n", line_number);
+            *program = {};
+            return false;
+        }
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        cursor += length;
+        cursor += strspn(cursor, "\r\n");
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        char *name = strtok(line, " \t");
+        if (name == NULL)
+            continue;
+        char *equal = strtok(NULL, " \t");
+        char *type = strtok(NULL, " \t");
+        char *args = strtok(NULL, "");
+        char empty[] = "";
+        if (equal == NULL || strcmp(equal, "=") != 0 || type == NULL)
+        {
+            printf("[ERROR] Noise graph line %zu: expected 'name = type args...'\n", line_number);
+            *program = {};
+            return false;
+        }
+        if (program->count >= NOISE_MAX_NODES || strlen(name) >= NOISE_MAX_NAME)
+        {
+            printf("[ERROR] Noise graph line %zu: too many nodes or name too long\n", line_number);
+            *program = {};
+            return false;
+        }
+        if (!compile_noise_line(&program->ops[program->count], names, program->count, type, args != NULL ? args : empty, line_number))
+        {
+            *program = {};
+            return false;
+        }
+        strcpy(names[program->count], name);
+        program->count++;
+    }
+    if (program->count == 0)
+    {
+        printf("[ERROR] Noise graph is empty\n");
+        return false;
+    }
+    return true;
+}
+
+// Matches the original two octaves heightmap
+const char *default_terrain_noise = "height = fbm octaves=2 frequency=0.01 lacunarity=6 gain=0.125 amplitude=8 offset=30\n";
+
+#endif
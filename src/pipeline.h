@@ -0,0 +1,555 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include "types.h"
+#include "world.h"
+#include "decoration.h"
+#include "storage.h"
+#include "mesher.h"
+
+// Slice generation pipeline
+//
+// Slices go through the stages of SliceStatus one at a time, slice->status
+// being the last completed stage. A stage only runs once the 26 neighbors
+// reached stage_neighbor_prerequisite[stage]:
+//   - light applies the blocks spilled by neighbors decoration, they must all
+//     be decorated
+//   - mesh reads border blocks, neighbors must not change anymore
+// Stages run on worker threads and only write into their own slice, the
+// column data is computed once by the first slice needing it. Meshes are
+// uploaded by the main thread: finished slices wait in completed_meshes, still
+// busy and with their neighbors pinned so that the blocks they read stay loaded.
+
+// clang-format off
+static const SliceStatus stage_neighbor_prerequisite[] = {
+    SLICE_EMPTY,     // EMPTY
+    SLICE_EMPTY,     // NOISE
+    SLICE_EMPTY,     // SURFACE
+    SLICE_EMPTY,     // CARVED
+    SLICE_EMPTY,     // DECORATED
+    SLICE_DECORATED, // LIT
+    SLICE_LIT,       // MESHED
+};
+// clang-format on
+
+void init_slice(Slice_t *slice, Chunk_t *chunk, int64_t z)
+{
+    slice->x = chunk->x;
+    slice->y = chunk->y;
+    slice->z = 16 * z;
+    slice->chunk = chunk;
+    slice->status = SLICE_EMPTY;
+    slice->busy = false;
+    slice->pins = 0;
+    slice->target_lod = 0;
+    slice->mesh_settings = {};
+    std::fill(slice->face_connections, slice->face_connections + 6, 0x3F);
+    slice->table = {};
+}
+
+void init_chunk(Chunk_t *chunk, int64_t x, int64_t y)
+{
+    chunk->x = 16 * x;
+    chunk->y = 16 * y;
+    chunk->slices_count = 0;
+}
+
+void init_world(World_t *world)
+{
+    char *terrain_noise = readfile("resources/terrain.noise");
+    if (terrain_noise == NULL || !compile_noise_graph(&world->heightmap, terrain_noise))
+    {
+        printf("[ERROR] Falling back to the default terrain noise\n");
+        compile_noise_graph(&world->heightmap, default_terrain_noise);
+    }
+    free(terrain_noise);
+}
+
+float column_height(World_t *world, const BiomeColumn_t *column, double block_x, double block_y)
+{
+    return biome_height(column, sample_noise(&world->heightmap, block_x, block_y));
+}
+
+void generate_chunk_columns(World_t *world, Chunk_t *chunk)
+{
+    compute_biome_map(&chunk->biomes, chunk->x, chunk->y);
+    for (int64_t x = 0; x < 16; x++)
+    {
+        for (int64_t y = 0; y < 16; y++)
+        {
+            BiomeColumn_t column = sample_biome_column(&chunk->biomes, x, y);
+            chunk->heights[x + 16 * y] = floor(column_height(world, &column, x + chunk->x, y + chunk->y));
+        }
+    }
+}
+
+// Same surface as the slices, before caves and decoration
+void generate_chunk_summary(World_t *world, ChunkSummary_t *summary)
+{
+    BiomeMap_t map;
+    compute_biome_map(&map, summary->x, summary->y);
+    for (int64_t x = 0; x < 16; x++)
+    {
+        for (int64_t y = 0; y < 16; y++)
+        {
+            const BiomeColumn_t column = sample_biome_column(&map, x, y);
+            const Biome_t *biome = &biomes[column.biome];
+            const glm::vec3 tint = block_is_tinted(biome->surface_block) ? column.tint : glm::vec3(1.f);
+            summary->heights[x + 16 * y] = floor(column_height(world, &column, x + summary->x, y + summary->y));
+            summary->top_blocks[x + 16 * y] = biome->surface_block;
+            summary->tints[x + 16 * y][0] = tint.r * 255.f;
+            summary->tints[x + 16 * y][1] = tint.g * 255.f;
+            summary->tints[x + 16 * y][2] = tint.b * 255.f;
+        }
+    }
+}
+
+// Column biomes and heights, then the bare stone and air volume
+void generate_noise(World_t *world, Slice_t *slice)
+{
+    Chunk_t *chunk = slice->chunk;
+    std::call_once(chunk->generated, generate_chunk_columns, world, chunk);
+
+    slice->table.push_back(block_air);                             // AIR
+    slice->table.push_back(Block_t{1});                            // STONE
+    slice->table.push_back(Block_t{2});                            // DIRT
+    slice->table.push_back(Block_t{3, biomes[BIOME_PLAINS].tint}); // GRASS
+    slice->table.push_back(Block_t{4});                            // BEDROCK
+    slice->table.push_back(Block_t{5});                            // OAK LOG
+    slice->table.push_back(Block_t{6, biomes[BIOME_PLAINS].tint}); // OAK LEAVE
+    slice->table.push_back(Block_t{7});                            // SAND
+    slice->table.push_back(Block_t{8});                            // SNOW
+    for (int64_t x = 0; x < 16; x++)
+    {
+        for (int64_t y = 0; y < 16; y++)
+        {
+            const int64_t height = chunk->heights[x + 16 * y];
+            for (int64_t z = 0; z < 16; z++)
+            {
+                slice->blocks[block_index(x, y, z)] = z + slice->z > height ? 0 : 1;
+            }
+        }
+    }
+}
+
+// Biome surface and filler blocks on top of the stone
+void generate_surface(World_t *world, Slice_t *slice)
+{
+    const Chunk_t *chunk = slice->chunk;
+    for (int64_t x = 0; x < 16; x++)
+    {
+        double block_x = x + slice->x;
+        for (int64_t y = 0; y < 16; y++)
+        {
+            double block_y = y + slice->y;
+            const int64_t height = chunk->heights[x + 16 * y];
+            if (height < slice->z || height - 5 >= slice->z + 16)
+                continue;
+            float scale = 0.1f;
+            const BiomeColumn_t column = sample_biome_column(&chunk->biomes, x, y);
+            const Biome_t *biome = &biomes[column.biome];
+            const glm::vec3 tint = block_is_tinted(biome->surface_block) ? column.tint : glm::vec3(1.f);
+            const int64_t dirt_height = (0.5f + 0.5f * stb_perlin_noise3(scale * block_x, scale * block_y, 0.f, 0, 0, 0)) * 5.f;
+            const int64_t bottom = std::max(slice->z, height - dirt_height);
+            const int64_t top = std::min(slice->z + 15, height);
+            for (int64_t block_z = bottom; block_z <= top; block_z++)
+            {
+                uint16_t *block = &slice->blocks[block_index(x, y, block_z - slice->z)];
+                if (*block != 1)
+                    continue;
+                *block = block_z == height ? find_or_add_block(slice, Block_t{biome->surface_block, tint})
+                                           : find_or_add_block(slice, Block_t{biome->filler_block});
+            }
+        }
+    }
+}
+
+void generate_caves(World_t *world, Slice_t *slice)
+{
+    const Chunk_t *chunk = slice->chunk;
+    for (int64_t x = 0; x < 16; x++)
+    {
+        double block_x = x + slice->x;
+        for (int64_t y = 0; y < 16; y++)
+        {
+            double block_y = y + slice->y;
+            if (slice->z > chunk->heights[x + 16 * y])
+                continue;
+            for (int64_t z = 0; z < 16; z++)
+            {
+                double block_z = z + slice->z;
+                uint16_t *block = &slice->blocks[block_index(x, y, z)];
+                if (*block == 0)
+                    continue;
+                float scale = 0.05f;
+                float cave = stb_perlin_noise3(scale * block_x, scale * block_y, scale * block_z, 0, 0, 0);
+                if (cave >= 0.4f)
+                    *block = 0;
+            }
+        }
+    }
+}
+
+// There is no lighting yet, this stage settles the blocks spilled by neighbors
+void generate_light(World_t *world, Slice_t *slice)
+{
+    apply_pending_blocks(world, slice);
+}
+
+// Returns the status reached, saved slices are complete once loaded
+SliceStatus run_generation_stage(World_t *world, Slice_t *slice, SliceStatus stage)
+{
+    switch (stage)
+    {
+    case SLICE_NOISE:
+        if (load_saved_slice(world, slice))
+            return SLICE_LIT;
+        generate_noise(world, slice);
+        break;
+    case SLICE_SURFACE:
+        generate_surface(world, slice);
+        break;
+    case SLICE_CARVED:
+        generate_caves(world, slice);
+        break;
+    case SLICE_DECORATED:
+        decorate_slice(world, slice);
+        break;
+    case SLICE_LIT:
+        generate_light(world, slice);
+        break;
+    default:
+        printf("[ERROR] Generation stage %i can't run on a worker\n", (int)stage);
+        break;
+    }
+    return stage;
+}
+
+bool slice_ready_for_stage(Slice_t *slice, SliceStatus stage)
+{
+    if (slice->busy || slice->status + 1 != stage)
+        return false;
+    if (stage_neighbor_prerequisite[stage] == SLICE_EMPTY)
+        return true;
+    for (size_t i = 0; i < 26; i++)
+    {
+        Slice_t *neighbor = slice->neighbors[i];
+        if (neighbor == NULL || neighbor->status < stage_neighbor_prerequisite[stage])
+            return false;
+    }
+    return true;
+}
+
+void generation_worker(World_t *world)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    while (true)
+    {
+        GenerationJob_t job = {NULL};
+        ChunkSummary_t *summary = NULL;
+        {
+            std::unique_lock<std::mutex> lock(scheduler->mutex);
+            scheduler->condition.wait(lock, [scheduler]
+                                      { return !scheduler->running || !scheduler->jobs.empty() || !scheduler->summary_jobs.empty(); });
+            if (!scheduler->running)
+                return;
+            if (!scheduler->jobs.empty())
+            {
+                job = scheduler->jobs.front();
+                scheduler->jobs.pop_front();
+            }
+            else
+            {
+                summary = scheduler->summary_jobs.front();
+                scheduler->summary_jobs.pop_front();
+            }
+        }
+        if (summary != NULL)
+        {
+            generate_chunk_summary(world, summary);
+            {
+                std::lock_guard<std::mutex> lock(scheduler->mutex);
+                scheduler->completed_summaries.push_back(chunk_key(summary->x / 16, summary->y / 16));
+            }
+            summary->busy = false;
+            continue;
+        }
+        if (job.stage == SLICE_MESHED)
+        {
+            CompletedMesh_t mesh = {job.slice, job.mesh_settings};
+            mesh.faces_count = generate_mesh(world, job.slice, job.mesh_settings, &mesh.occluders);
+            slice_face_connections(job.slice, mesh.face_connections);
+            std::lock_guard<std::mutex> lock(scheduler->mutex);
+            scheduler->completed_meshes.push_back(std::move(mesh));
+            continue;
+        }
+        job.slice->status = run_generation_stage(world, job.slice, job.stage);
+        job.slice->busy = false;
+    }
+}
+
+void start_generation(World_t *world, size_t thread_count)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    scheduler->running = true;
+    for (size_t i = 0; i < std::max<size_t>(1, thread_count); i++)
+    {
+        scheduler->workers.push_back(std::thread(generation_worker, world));
+    }
+}
+
+void stop_generation(World_t *world)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->running = false;
+        scheduler->jobs.clear();
+        scheduler->summary_jobs.clear();
+    }
+    scheduler->condition.notify_all();
+    for (std::thread &worker : scheduler->workers)
+    {
+        worker.join();
+    }
+    scheduler->workers.clear();
+    scheduler->completed_meshes.clear();
+}
+
+// Queues the next stage of every slice that can advance, main thread only
+void schedule_generation(World_t *world)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    std::vector<GenerationJob_t> jobs;
+    for (auto &entry : world->slices)
+    {
+        Slice_t *slice = entry.second;
+        if (slice->status >= SLICE_LIT)
+            continue;
+        SliceStatus stage = (SliceStatus)(slice->status + 1);
+        if (!slice_ready_for_stage(slice, stage))
+            continue;
+        slice->busy = true;
+        jobs.push_back(GenerationJob_t{slice, stage});
+    }
+    if (jobs.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->jobs.insert(scheduler->jobs.end(), jobs.begin(), jobs.end());
+    }
+    scheduler->condition.notify_all();
+}
+
+void pin_neighbors(Slice_t *slice, int delta)
+{
+    for (size_t i = 0; i < 26; i++)
+    {
+        slice->neighbors[i]->pins += delta;
+    }
+}
+
+bool neighbors_lit(Slice_t *slice)
+{
+    for (size_t i = 0; i < 26; i++)
+    {
+        if (slice->neighbors[i] == NULL || slice->neighbors[i]->status < SLICE_LIT)
+            return false;
+    }
+    return true;
+}
+
+// Skirts go toward the face neighbors meshed at another lod
+MeshSettings_t target_mesh_settings(Slice_t *slice, bool greedy_meshing)
+{
+    MeshSettings_t settings = {slice->target_lod, 0, greedy_meshing};
+    for (int face = 0; face < 6; face++)
+    {
+        const Slice_t *neighbor = slice->neighbors[neighbor_index(face_neighbors[face][0], face_neighbors[face][1], face_neighbors[face][2])];
+        if (neighbor != NULL && neighbor->target_lod != slice->target_lod)
+            settings.skirts |= 1 << face;
+    }
+    return settings;
+}
+
+// Queues the meshing of every lit slice which neighbors are lit, and of the
+// meshed slices which settings changed (lod, greedy_meshing). Main thread only
+void schedule_meshing(World_t *world, bool greedy_meshing)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    std::vector<GenerationJob_t> jobs;
+    for (auto &entry : world->slices)
+    {
+        Slice_t *slice = entry.second;
+        if (slice->busy || slice->status < SLICE_LIT || !neighbors_lit(slice))
+            continue;
+        const MeshSettings_t settings = target_mesh_settings(slice, greedy_meshing);
+        if (slice->status == SLICE_MESHED && settings == slice->mesh_settings)
+            continue;
+        slice->busy = true;
+        pin_neighbors(slice, 1);
+        jobs.push_back(GenerationJob_t{slice, SLICE_MESHED, settings});
+    }
+    if (jobs.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->jobs.insert(scheduler->jobs.end(), jobs.begin(), jobs.end());
+    }
+    scheduler->condition.notify_all();
+}
+
+// Takes at most count meshes from the completion queue, the caller uploads
+// them then calls finish_meshing. Main thread only
+void take_completed_meshes(World_t *world, size_t count, std::vector<CompletedMesh_t> *meshes)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    while (count-- > 0 && !scheduler->completed_meshes.empty())
+    {
+        meshes->push_back(std::move(scheduler->completed_meshes.front()));
+        scheduler->completed_meshes.pop_front();
+    }
+}
+
+void finish_meshing(const CompletedMesh_t *mesh)
+{
+    Slice_t *slice = mesh->slice;
+    pin_neighbors(slice, -1);
+    slice->faces_count = mesh->faces_count;
+    std::copy(mesh->face_connections, mesh->face_connections + 6, slice->face_connections);
+    slice->occluders = mesh->occluders;
+    slice->mesh_settings = mesh->mesh_settings;
+    slice->status = SLICE_MESHED;
+    slice->busy = false;
+}
+
+// Keeps the summaries within summary_radius of the center chunk, main thread only
+void update_summaries(World_t *world, int64_t center_x, int64_t center_y)
+{
+    GenerationScheduler_t *scheduler = &world->scheduler;
+    const int64_t radius = world->summary_radius;
+    if ((int64_t)world->summaries.size() > (2 * radius + 1) * (2 * radius + 1))
+    {
+        for (auto summary = world->summaries.begin(); summary != world->summaries.end();)
+        {
+            ChunkSummary_t *current = summary->second;
+            const int64_t distance = std::max(std::abs(current->x / 16 - center_x), std::abs(current->y / 16 - center_y));
+            if (distance <= radius || current->busy)
+            {
+                summary++;
+                continue;
+            }
+            delete current;
+            summary = world->summaries.erase(summary);
+        }
+    }
+    if (world->summaries_loaded && world->summaries_center_x == center_x && world->summaries_center_y == center_y)
+        return;
+    world->summaries_loaded = true;
+    world->summaries_center_x = center_x;
+    world->summaries_center_y = center_y;
+
+    std::vector<ChunkSummary_t *> jobs;
+    for (int64_t y = center_y - radius; y <= center_y + radius; y++)
+    {
+        for (int64_t x = center_x - radius; x <= center_x + radius; x++)
+        {
+            ChunkSummary_t *&summary = world->summaries[chunk_key(x, y)];
+            if (summary != NULL)
+                continue;
+            summary = new ChunkSummary_t();
+            summary->x = 16 * x;
+            summary->y = 16 * y;
+            summary->busy = true;
+            jobs.push_back(summary);
+        }
+    }
+    // Closest first
+    std::sort(jobs.begin(), jobs.end(), [center_x, center_y](const ChunkSummary_t *a, const ChunkSummary_t *b)
+              { return std::max(std::abs(a->x / 16 - center_x), std::abs(a->y / 16 - center_y)) <
+                       std::max(std::abs(b->x / 16 - center_x), std::abs(b->y / 16 - center_y)); });
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->summary_jobs.insert(scheduler->summary_jobs.end(), jobs.begin(), jobs.end());
+    }
+    scheduler->condition.notify_all();
+}
+
+void unload_summaries(World_t *world)
+{
+    for (auto &summary : world->summaries)
+    {
+        delete summary.second;
+    }
+    world->summaries.clear();
+    world->scheduler.completed_summaries.clear();
+    world->summaries_loaded = false;
+}
+
+Slice_t *load_slice(World_t *world, int64_t x, int64_t y, int64_t z)
+{
+    Chunk_t *chunk = find_chunk(world, x, y);
+    if (chunk == NULL)
+    {
+        chunk = new Chunk_t();
+        init_chunk(chunk, x, y);
+        world->chunks[chunk_key(x, y)] = chunk;
+    }
+    chunk->slices_count++;
+
+    Slice_t *slice = new Slice_t();
+    init_slice(slice, chunk, z);
+    for (int dz = -1; dz <= 1; dz++)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                if (dx == 0 && dy == 0 && dz == 0)
+                    continue;
+                Slice_t *neighbor = find_slice(world, x + dx, y + dy, z + dz);
+                slice->neighbors[neighbor_index(dx, dy, dz)] = neighbor;
+                if (neighbor != NULL)
+                    neighbor->neighbors[neighbor_index(-dx, -dy, -dz)] = slice;
+            }
+        }
+    }
+    world->slices[SliceKey_t{x, y, z}] = slice;
+    return slice;
+}
+
+// The caller releases the slice GPU resources, slice must not be busy
+void unload_slice(World_t *world, Slice_t *slice)
+{
+    for (int dz = -1; dz <= 1; dz++)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                if (dx == 0 && dy == 0 && dz == 0)
+                    continue;
+                Slice_t *neighbor = slice->neighbors[neighbor_index(dx, dy, dz)];
+                if (neighbor != NULL)
+                    neighbor->neighbors[neighbor_index(-dx, -dy, -dz)] = NULL;
+            }
+        }
+    }
+    world->slices.erase(slice_key(slice));
+    release_pending_blocks(world, slice);
+
+    Chunk_t *chunk = slice->chunk;
+    if (--chunk->slices_count == 0)
+    {
+        world->chunks.erase(chunk_key(chunk->x / 16, chunk->y / 16));
+        delete chunk;
+    }
+    delete slice;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "types.h"
+#include "storage.h"
+
+unsigned int compile_shader(const char *path, unsigned int type)
+{
+    char *source = readfile(path);
+    if (source == NULL)
+        return 0;
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    free(source);
+
+    int compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        printf("[ERROR] Failed to compile %s\n%s\n", path, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+void reflect_uniforms(ShaderProgram_t *program)
+{
+    program->uniforms.clear();
+    int count = 0;
+    int max_length = 0;
+    glGetProgramiv(program->id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program->id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<char> name(std::max(max_length, 1));
+    for (int i = 0; i < count; i++)
+    {
+        int size;
+        GLenum type;
+        glGetActiveUniform(program->id, i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+        // Members of uniform blocks have no location
+        const int location = glGetUniformLocation(program->id, name.data());
+        if (location < 0)
+            continue;
+        std::string key = name.data();
+        const size_t bracket = key.find('[');
+        if (bracket != std::string::npos)
+            key.resize(bracket);
+        program->uniforms[key] = location;
+    }
+}
+
+// -1 when the uniform is not used by the program, which glUniform* ignores
+int uniform_location(const ShaderProgram_t *program, const char *name)
+{
+    auto it = program->uniforms.find(name);
+    return it != program->uniforms.end() ? it->second : -1;
+}
+
+// False when a shader is missing or doesn't compile or link, the program is
+// left empty then and draws nothing
+bool create_program(ShaderProgram_t *program, const char *vertex_path, const char *fragment_path, const char *geometry_path = NULL)
+{
+    program->id = 0;
+    program->uniforms.clear();
+    unsigned int vertex_shader = compile_shader(vertex_path, GL_VERTEX_SHADER);
+    unsigned int fragment_shader = compile_shader(fragment_path, GL_FRAGMENT_SHADER);
+    unsigned int geometry_shader = geometry_path != NULL ? compile_shader(geometry_path, GL_GEOMETRY_SHADER) : 0;
+    if (vertex_shader == 0 || fragment_shader == 0 || (geometry_path != NULL && geometry_shader == 0))
+    {
+        printf("[ERROR] Failed to create the program of %s and %s\n", vertex_path, fragment_path);
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        glDeleteShader(geometry_shader);
+        return false;
+    }
+
+    program->id = glCreateProgram();
+    glAttachShader(program->id, vertex_shader);
+    glAttachShader(program->id, fragment_shader);
+    if (geometry_shader != 0)
+    {
+        glAttachShader(program->id, geometry_shader);
+    }
+    glLinkProgram(program->id);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    if (geometry_shader != 0)
+    {
+        glDeleteShader(geometry_shader);
+    }
+
+    int linked = 0;
+    glGetProgramiv(program->id, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program->id, sizeof(log), NULL, log);
+        printf("[ERROR] Failed to link %s and %s\n%s\n", vertex_path, fragment_path, log);
+        glDeleteProgram(program->id);
+        program->id = 0;
+        return false;
+    }
+
+    // Version 330 shaders can't set the binding in the layout
+    const unsigned int frame_block = glGetUniformBlockIndex(program->id, "Frame");
+    if (frame_block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program->id, frame_block, FRAME_UNIFORMS_BINDING);
+    reflect_uniforms(program);
+    return true;
+}
+
+unsigned int create_frame_uniforms()
+{
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms_t), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, buffer);
+    return buffer;
+}
+
+void upload_frame_uniforms(unsigned int buffer, const FrameUniforms_t *uniforms)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms_t), uniforms);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "types.h"
+
+// Blocks above the fitted cascades still cast shadows in them, the light
+// frustums extend this far towards the light
+#define SHADOW_CASTERS_MARGIN 128.f
+
+// Blend of logarithmic and uniform splits, logarithmic gives the near
+// cascades more resolution
+#define SHADOW_SPLITS_LAMBDA 0.75f
+
+// (Re)allocates the depth texture array when the count or resolution changes
+void resize_shadow_cascades(ShadowCascades_t *shadows, int count, int resolution)
+{
+    if (shadows->framebuffer == 0)
+        glGenFramebuffers(1, &shadows->framebuffer);
+    if (shadows->texture != 0 && shadows->count == count && shadows->resolution == resolution)
+        return;
+    if (shadows->texture != 0)
+        glDeleteTextures(1, &shadows->texture);
+    shadows->count = count;
+    shadows->resolution = resolution;
+
+    glGenTextures(1, &shadows->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadows->texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, resolution, resolution, count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float border_color[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border_color);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows->framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows->texture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Splits the view frustum up to distance and fits an orthographic light
+// frustum around the bounding sphere of each part. The sphere only depends on
+// the splits, so the cascades keep their size when the camera turns, and they
+// move by whole texels to avoid shimmering edges
+void fit_shadow_cascades(ShadowCascades_t *shadows, const Camera_t *camera, float aspect, const glm::vec3 &light_direction, float distance)
+{
+    const int count = shadows->count;
+    const float near_plane = camera->near;
+    const float far_plane = std::min(camera->far, distance);
+    for (int i = 0; i <= count; i++)
+    {
+        const float t = (float)i / count;
+        const float logarithmic = near_plane * std::pow(far_plane / near_plane, t);
+        const float uniform = near_plane + (far_plane - near_plane) * t;
+        shadows->splits[i] = SHADOW_SPLITS_LAMBDA * logarithmic + (1.f - SHADOW_SPLITS_LAMBDA) * uniform;
+    }
+
+    const glm::vec3 forward = glm::normalize(camera->direction);
+    const glm::vec3 right = glm::normalize(glm::cross(forward, camera->up));
+    const glm::vec3 up = glm::cross(right, forward);
+    const float tan_y = std::tan(camera->fov / 2.f);
+    const float tan_x = tan_y * aspect;
+    const glm::vec3 light_up = std::abs(light_direction.z) > 0.99f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(0.f, 0.f, 1.f);
+
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 corners[8];
+        for (int c = 0; c < 8; c++)
+        {
+            const float depth = shadows->splits[i + (c >> 2)];
+            const float x = (c & 1) ? tan_x : -tan_x;
+            const float y = (c & 2) ? tan_y : -tan_y;
+            corners[c] = camera->position + depth * (forward + x * right + y * up);
+        }
+        glm::vec3 center(0.f);
+        for (int c = 0; c < 8; c++)
+            center += corners[c];
+        center /= 8.f;
+        float radius = 0.f;
+        for (int c = 0; c < 8; c++)
+            radius = std::max(radius, glm::length(corners[c] - center));
+        radius = std::ceil(radius * 16.f) / 16.f;
+
+        const glm::mat4 view = glm::lookAt(center - light_direction * (radius + SHADOW_CASTERS_MARGIN), center, light_up);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.f, 2.f * radius + SHADOW_CASTERS_MARGIN);
+
+        // Moves the projection so the world origin falls on a texel
+        const float half_resolution = shadows->resolution / 2.f;
+        const glm::vec4 origin = projection * view * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        projection[3][0] += (std::round(origin.x * half_resolution) - origin.x * half_resolution) / half_resolution;
+        projection[3][1] += (std::round(origin.y * half_resolution) - origin.y * half_resolution) / half_resolution;
+        shadows->matrices[i] = projection * view;
+    }
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include "types.h"
+#include "world.h"
+
+// Save format
+//
+// One file per chunk column, <save_path>/<chunk x>.<chunk y>.chunk, holding
+// the saved slices of the column once lit (all spills applied). Each slice
+// also keeps the blocks its decoration spilled into neighbors, so that slices
+// generated next to it later still receive them.
+//
+//   header: magic, version, chunk x, chunk y (int64), slices count (uint32)
+//   slice:  z (int64), payload size (uint32), payload
+//   payload: palette count (uint16), palette (block id, tint)
+//            runs count (uint16), runs (length, palette index as uint16)
+//            spill targets (uint32), per target slice key, count (uint32),
+//            then blocks (x, y, z as uint8, block id, tint)
+//
+// Files are written aside and renamed, so a file that exists is complete.
+
+#define SAVE_MAGIC 0x43434d42 // "BMCC"
+#define SAVE_VERSION 1
+
+char *readfile(const char *filepath)
+{
+    FILE *fp;
+    fopen_s(&fp, filepath, "r");
+    if (!fp)
+    {
+        printf("[ERROR] Failed to open %s\n", filepath);
+        return NULL;
+    }
+    fseek(fp, 0L, SEEK_END);
+    long lSize = ftell(fp);
+    rewind(fp);
+    char *buffer = (char *)calloc(1, lSize + 1);
+    if (!buffer)
+    {
+        printf("[ERROR] Failed to allocate memory for file %s\n", filepath);
+        fclose(fp);
+        return NULL;
+    }
+    fread(buffer, lSize, 1, fp);
+    fclose(fp);
+    return buffer;
+}
+
+typedef struct SaveReader
+{
+    const std::vector<uint8_t> *data;
+    size_t cursor;
+    bool failed;
+} SaveReader_t;
+
+template <typename T>
+void save_write(std::vector<uint8_t> *data, T value)
+{
+    const uint8_t *bytes = (const uint8_t *)&value;
+    data->insert(data->end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+T save_read(SaveReader_t *reader)
+{
+    T value = {};
+    if (reader->failed || reader->cursor + sizeof(T) > reader->data->size())
+    {
+        reader->failed = true;
+        return value;
+    }
+    std::memcpy(&value, reader->data->data() + reader->cursor, sizeof(T));
+    reader->cursor += sizeof(T);
+    return value;
+}
+
+void save_write_block(std::vector<uint8_t> *data, const Block_t *block)
+{
+    save_write<BlockId_t>(data, block->block_id);
+    save_write<float>(data, block->tint.r);
+    save_write<float>(data, block->tint.g);
+    save_write<float>(data, block->tint.b);
+}
+
+Block_t save_read_block(SaveReader_t *reader)
+{
+    Block_t block;
+    block.block_id = save_read<BlockId_t>(reader);
+    block.tint.r = save_read<float>(reader);
+    block.tint.g = save_read<float>(reader);
+    block.tint.b = save_read<float>(reader);
+    return block;
+}
+
+std::string chunk_save_path(World_t *world, int64_t chunk_x, int64_t chunk_y)
+{
+    return world->save_path + "/" + std::to_string(chunk_x) + "." + std::to_string(chunk_y) + ".chunk";
+}
+
+bool is_chunk_saved(World_t *world, int64_t chunk_x, int64_t chunk_y)
+{
+    return std::filesystem::exists(chunk_save_path(world, chunk_x, chunk_y));
+}
+
+void serialize_slice(World_t *world, Slice_t *slice, std::vector<uint8_t> *data)
+{
+    save_write<uint16_t>(data, slice->table.size());
+    for (const Block_t &block : slice->table)
+    {
+        save_write_block(data, &block);
+    }
+
+    std::vector<uint16_t> runs;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        if (runs.empty() || runs.back() != slice->blocks[i])
+        {
+            runs.push_back(0);
+            runs.push_back(slice->blocks[i]);
+        }
+        runs[runs.size() - 2]++;
+    }
+    save_write<uint16_t>(data, runs.size() / 2);
+    for (uint16_t value : runs)
+    {
+        save_write<uint16_t>(data, value);
+    }
+
+    // Blocks this slice published for its neighbors
+    const SliceKey_t source = slice_key(slice);
+    std::vector<std::pair<SliceKey_t, const std::vector<PendingBlock_t> *>> spills;
+    std::lock_guard<std::mutex> lock(world->pending_mutex);
+    for (int dz = -1; dz <= 1; dz++)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                const SliceKey_t target = {source.x + dx, source.y + dy, source.z + dz};
+                auto pending = world->pending_blocks.find(target);
+                if (pending == world->pending_blocks.end())
+                    continue;
+                auto blocks = pending->second.find(source);
+                if (blocks != pending->second.end())
+                    spills.push_back(std::make_pair(target, &blocks->second));
+            }
+        }
+    }
+    save_write<uint32_t>(data, spills.size());
+    for (const auto &spill : spills)
+    {
+        save_write<int64_t>(data, spill.first.x);
+        save_write<int64_t>(data, spill.first.y);
+        save_write<int64_t>(data, spill.first.z);
+        save_write<uint32_t>(data, spill.second->size());
+        for (const PendingBlock_t &block : *spill.second)
+        {
+            save_write<uint8_t>(data, block.x);
+            save_write<uint8_t>(data, block.y);
+            save_write<uint8_t>(data, block.z);
+            save_write_block(data, &block.block);
+        }
+    }
+}
+
+bool deserialize_slice(World_t *world, Slice_t *slice, SaveReader_t *reader)
+{
+    const uint16_t palette_count = save_read<uint16_t>(reader);
+    std::vector<Block_t> table;
+    for (size_t i = 0; i < palette_count; i++)
+    {
+        table.push_back(save_read_block(reader));
+    }
+
+    const uint16_t runs_count = save_read<uint16_t>(reader);
+    size_t block = 0;
+    for (size_t i = 0; i < runs_count && !reader->failed; i++)
+    {
+        const uint16_t length = save_read<uint16_t>(reader);
+        const uint16_t index = save_read<uint16_t>(reader);
+        if (block + length > 4096 || index >= palette_count)
+        {
+            reader->failed = true;
+            break;
+        }
+        std::fill(slice->blocks + block, slice->blocks + block + length, index);
+        block += length;
+    }
+
+    const SliceKey_t source = slice_key(slice);
+    SliceMap<std::vector<PendingBlock_t>> spills;
+    const uint32_t targets_count = save_read<uint32_t>(reader);
+    for (size_t i = 0; i < targets_count && !reader->failed; i++)
+    {
+        SliceKey_t target;
+        target.x = save_read<int64_t>(reader);
+        target.y = save_read<int64_t>(reader);
+        target.z = save_read<int64_t>(reader);
+        const uint32_t count = save_read<uint32_t>(reader);
+        std::vector<PendingBlock_t> *blocks = &spills[target];
+        for (size_t j = 0; j < count && !reader->failed; j++)
+        {
+            PendingBlock_t pending;
+            pending.x = save_read<uint8_t>(reader);
+            pending.y = save_read<uint8_t>(reader);
+            pending.z = save_read<uint8_t>(reader);
+            pending.block = save_read_block(reader);
+            blocks->push_back(pending);
+        }
+    }
+    if (reader->failed || block != 4096)
+        return false;
+
+    slice->table = std::move(table);
+    std::lock_guard<std::mutex> lock(world->pending_mutex);
+    for (auto &spill : spills)
+    {
+        world->pending_blocks[spill.first][source] = std::move(spill.second);
+    }
+    return true;
+}
+
+// Slices must be lit, written aside first then renamed over
+bool save_chunk(World_t *world, int64_t chunk_x, int64_t chunk_y, const std::vector<Slice_t *> &slices)
+{
+    std::vector<uint8_t> data;
+    save_write<uint32_t>(&data, SAVE_MAGIC);
+    save_write<uint32_t>(&data, SAVE_VERSION);
+    save_write<int64_t>(&data, chunk_x);
+    save_write<int64_t>(&data, chunk_y);
+    save_write<uint32_t>(&data, slices.size());
+    std::vector<uint8_t> payload;
+    for (Slice_t *slice : slices)
+    {
+        payload.clear();
+        serialize_slice(world, slice, &payload);
+        save_write<int64_t>(&data, slice->z / 16);
+        save_write<uint32_t>(&data, payload.size());
+        data.insert(data.end(), payload.begin(), payload.end());
+    }
+
+    const std::string path = chunk_save_path(world, chunk_x, chunk_y);
+    const std::string temporary_path = path + ".tmp";
+    FILE *fp;
+    fopen_s(&fp, temporary_path.c_str(), "wb");
+    if (!fp)
+    {
+        printf("[ERROR] Failed to open %s\n", temporary_path.c_str());
+        return false;
+    }
+    const bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    fclose(fp);
+    std::error_code error;
+    if (written)
+        std::filesystem::rename(temporary_path, path, error);
+    if (!written || error)
+    {
+        printf("[ERROR] Failed to write %s\n", path.c_str());
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+// Reads the column file and locates the slice payloads. Kept for the life of
+// the chunk, the game doesn't write column files
+void read_saved_column(World_t *world, Chunk_t *chunk)
+{
+    const int64_t chunk_x = chunk->x / 16;
+    const int64_t chunk_y = chunk->y / 16;
+    FILE *fp;
+    fopen_s(&fp, chunk_save_path(world, chunk_x, chunk_y).c_str(), "rb");
+    if (!fp)
+        return;
+    std::vector<uint8_t> data;
+    fseek(fp, 0L, SEEK_END);
+    data.resize(ftell(fp));
+    rewind(fp);
+    const bool read = fread(data.data(), 1, data.size(), fp) == data.size();
+    fclose(fp);
+
+    SaveReader_t reader = {&data, 0, !read};
+    const uint32_t magic = save_read<uint32_t>(&reader);
+    const uint32_t version = save_read<uint32_t>(&reader);
+    const int64_t saved_x = save_read<int64_t>(&reader);
+    const int64_t saved_y = save_read<int64_t>(&reader);
+    const uint32_t slices_count = save_read<uint32_t>(&reader);
+    if (reader.failed || magic != SAVE_MAGIC || version != SAVE_VERSION || saved_x != chunk_x || saved_y != chunk_y)
+    {
+        printf("[ERROR] Invalid save file for chunk %lli, %lli\n", (long long)chunk_x, (long long)chunk_y);
+        return;
+    }
+    std::vector<SavedSlice_t> slices;
+    for (size_t i = 0; i < slices_count && !reader.failed; i++)
+    {
+        SavedSlice_t slice;
+        slice.z = save_read<int64_t>(&reader);
+        slice.size = save_read<uint32_t>(&reader);
+        slice.offset = reader.cursor;
+        if (reader.failed || slice.offset + slice.size > data.size())
+        {
+            printf("[ERROR] Corrupted save file for chunk %lli, %lli\n", (long long)chunk_x, (long long)chunk_y);
+            return;
+        }
+        slices.push_back(slice);
+        reader.cursor += slice.size;
+    }
+    chunk->save_data = std::move(data);
+    chunk->saved_slices = std::move(slices);
+}
+
+// Fills slice from its column file, false when it was not saved
+bool load_saved_slice(World_t *world, Slice_t *slice)
+{
+    if (world->save_path.empty())
+        return false;
+    Chunk_t *chunk = slice->chunk;
+    std::call_once(chunk->save_read, read_saved_column, world, chunk);
+    for (const SavedSlice_t &saved : chunk->saved_slices)
+    {
+        if (saved.z != slice->z / 16)
+            continue;
+        SaveReader_t reader = {&chunk->save_data, saved.offset, false};
+        if (deserialize_slice(world, slice, &reader))
+            return true;
+        printf("[ERROR] Corrupted save file for chunk %lli, %lli\n", (long long)(chunk->x / 16), (long long)(chunk->y / 16));
+        return false;
+    }
+    return false;
+}
+
+#endif
@@ -2,9 +2,18 @@
 #define TYPES_H
 
 #include <vector>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <glm/glm.hpp>
 #include "blocks.h"
+#include "biomes.h"
 #include "generation.h"
+#include "noise_graph.h"
 
 typedef struct Transform
 {
@@ -48,7 +57,14 @@ typedef struct mInput
 
 typedef struct mDebugContext
 {
-    float ssao_strength = 1.f;
+    float ssao_strength = 0.f;
+    bool greedy_meshing = true;
+    bool level_of_detail = true;
+    bool cave_culling = true;
+    bool occlusion_culling = true;
+    int shadow_cascades = 3;
+    int shadow_resolution = 2048;
+    float shadow_distance = 192.f;
 } mDebugContext_t;
 
 typedef struct Block
@@ -59,43 +75,285 @@ typedef struct Block
 
 static Block_t block_air = {BlockId_t{0}};
 
-// Slice: 16x16x16
-// Chunk: 16x16x384, 24 slices high
+#define TINT_PALETTE_SIZE 65536
 
+// Slice: 16x16x16, the unit of generation, meshing and residency
+// Chunk: 16x16 column of slices, only holds the per column data (biomes, heights).
+// Slices are loaded on demand around the camera, vertically as well
+
+// Position (5 bits per axis, slice local), face (3 bits), then block id and
+// tint palette index (16 bits each)
+typedef struct PackedVertex
+{
+    uint32_t position_face;
+    uint32_t block_tint;
+} PackedVertex_t;
+
+// Every face of every block, bounds the quads of a slice mesh
+#define MAX_SLICE_QUADS (6 * 16 * 16 * 16)
+
+// Visible faces of a slice, per face then z then y, a bit per x
+typedef struct FaceMasks
+{
+    uint16_t rows[6][16][16];
+} FaceMasks_t;
+
+// Mesh emission storage reused between slices. Meshers size a range of
+// vertices per face for an upper bound of quads first, then write without
+// allocating. face_end is the write position of each range
+typedef struct MeshArena
+{
+    std::vector<PackedVertex_t> vertices;
+    size_t face_begin[6] = {};
+    size_t face_end[6] = {};
+} MeshArena_t;
+
+// Quads of 4 vertices, drawn with the shared quad index buffer. Quads are
+// sorted by face (see FACE_*), face_quads counts them per face. vertices,
+// face_quads and the bounds are written by the mesher, the rest belongs to
+// the main thread. vertices is released once uploaded, see release_mesh_vertices
 typedef struct RenderMesh
 {
-    std::vector<float> vertices;
-    std::vector<unsigned int> indices;
-    unsigned int vao;
-    unsigned int vbo;
-    unsigned int ebo;
+    std::vector<PackedVertex_t> vertices;
+    uint32_t face_quads[6];
+    glm::vec3 bounds_min; // Slice local, empty meshes have min > max
+    glm::vec3 bounds_max;
+    uint32_t first_quad;  // In the geometry arena
+    uint32_t quads_count; // Uploaded
+    uint32_t uploaded_face_quads[6]; // face_quads changes while the slice is remeshed
 } RenderMesh_t;
 
-typedef struct Slice
+// Rectangle of visible opaque faces, flat along one axis. Slice local, see find_occluders
+typedef struct Occluder
 {
-    uint8_t z;
-    uint8_t index;
-    RenderMesh_t mesh_blocks;
-    RenderMesh_t mesh_foliage;
-    std::vector<Block_t> table;
-    uint16_t blocks[4096];
-} Slice_t;
+    uint8_t min[3];
+    uint8_t max[3];
+} Occluder_t;
+
+typedef struct GeometryRange
+{
+    uint32_t first;
+    uint32_t count;
+} GeometryRange_t;
+
+// The vertices of every slice mesh, in a single buffer suballocated in quads,
+// see geometry.h. Drawn through a single VAO, with the slice origins as a per
+// draw attribute
+typedef struct GeometryArena
+{
+    std::vector<GeometryRange_t> free_ranges; // Sorted, never adjacent
+    uint32_t capacity = 0;                    // In quads
+    unsigned int vao = 0;
+    unsigned int vbo = 0;
+    unsigned int origins = 0;  // Per draw slice origin
+    unsigned int commands = 0; // Indirect draws
+} GeometryArena_t;
+
+// Layout of glMultiDrawElementsIndirect commands. base_instance indexes the origins
+typedef struct DrawCommand
+{
+    uint32_t count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    uint32_t base_instance;
+} DrawCommand_t;
+
+// Draws of a frame, the passes submit consecutive commands
+typedef struct DrawList
+{
+    std::vector<DrawCommand_t> commands;
+    std::vector<glm::vec3> origins;
+} DrawList_t;
+
+// Linked program and the locations of its uniforms, reflected at link time.
+// Arrays are stored under their name without [0]
+typedef struct ShaderProgram
+{
+    unsigned int id = 0;
+    std::unordered_map<std::string, int> uniforms;
+} ShaderProgram_t;
+
+#define FRAME_UNIFORMS_BINDING 0
+#define MAX_SHADOW_CASCADES 4
+
+// std140 layout of the Frame uniform block of the shaders, written once per frame
+typedef struct FrameUniforms
+{
+    glm::mat4 view_projection;
+    glm::mat4 light_space_matrices[MAX_SHADOW_CASCADES];
+    float ssao_strength;
+    int32_t shadow_cascades;
+    float padding[2];
+} FrameUniforms_t;
+
+// Orthographic shadow maps covering consecutive slices of the view frustum, one
+// layer of the depth texture array each, see fit_shadow_cascades
+typedef struct ShadowCascades
+{
+    unsigned int texture = 0;
+    unsigned int framebuffer = 0;
+    int resolution = 0; // Of the allocated texture
+    int count = 0;
+    glm::mat4 matrices[MAX_SHADOW_CASCADES];
+    float splits[MAX_SHADOW_CASCADES + 1]; // Camera distances the cascades start and end at
+} ShadowCascades_t;
+
+// Planes of a view frustum, a x + b y + c z + d >= 0 inside. Not normalized,
+// only the side of a point is tested
+typedef struct Frustum
+{
+    glm::vec4 planes[6];
+} Frustum_t;
+
+// Axis aligned boxes stored per component, tested four at a time, see cull_boxes
+typedef struct BoxList
+{
+    std::vector<float> min_x;
+    std::vector<float> min_y;
+    std::vector<float> min_z;
+    std::vector<float> max_x;
+    std::vector<float> max_y;
+    std::vector<float> max_z;
+    std::vector<uint8_t> visible;
+} BoxList_t;
+
+// How a slice is meshed. lod halves the resolution per level, skirts has a bit
+// per face (see FACE_*) whose neighbor is at another lod
+typedef struct MeshSettings
+{
+    uint8_t lod;
+    uint8_t skirts;
+    bool greedy;
+} MeshSettings_t;
+
+inline bool operator==(const MeshSettings_t &a, const MeshSettings_t &b)
+{
+    return a.lod == b.lod && a.skirts == b.skirts && a.greedy == b.greedy;
+}
+
+#define MAX_LOD 2
+
+// Generation stages, in order. A slice status is the last stage it completed
+enum SliceStatus : uint8_t
+{
+    SLICE_EMPTY,
+    SLICE_NOISE,
+    SLICE_SURFACE,
+    SLICE_CARVED,
+    SLICE_DECORATED,
+    SLICE_LIT,
+    SLICE_MESHED
+};
+
+// Payload of a slice in its column file, see storage.h
+typedef struct SavedSlice
+{
+    int64_t z; // In slices
+    size_t offset;
+    uint32_t size;
+} SavedSlice_t;
 
 typedef struct Chunk
 {
     int64_t x;
     int64_t y;
-    uint32_t section_x;
-    uint32_t section_y;
-    Slice_t slices[24];
+    std::once_flag generated; // Biomes and heights, computed by the first slice reaching noise
+    std::once_flag save_read; // Column file, read by the first slice loading from it
+    std::vector<uint8_t> save_data;
+    std::vector<SavedSlice_t> saved_slices;
+    BiomeMap_t biomes;
+    int64_t heights[16 * 16];
+    uint32_t slices_count; // Loaded slices of this column, main thread only
 } Chunk_t;
 
-typedef struct Section
+// Slice coordinates (in slices, not blocks)
+typedef struct SliceKey
+{
+    int64_t x;
+    int64_t y;
+    int64_t z;
+
+    bool operator==(const SliceKey &other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+} SliceKey_t;
+
+struct SliceKeyHash
+{
+    size_t operator()(const SliceKey_t &key) const
+    {
+        return hash_coords(0, key.x, key.y, key.z);
+    }
+};
+
+typedef struct Slice
+{
+    int64_t x;
+    int64_t y;
+    int64_t z;
+    Chunk_t *chunk;
+    std::atomic<SliceStatus> status;
+    std::atomic<bool> busy; // A stage is queued or running
+    Slice *neighbors[26];   // See neighbor_index, NULL when not loaded
+    RenderMesh_t meshes[LAYERS_COUNT]; // Per RenderLayer
+    // Main thread only
+    uint32_t faces_count;          // Visible block faces of the uploaded mesh, before any merging
+    MeshSettings_t mesh_settings;  // Of the uploaded mesh
+    uint8_t target_lod;            // Wanted at the camera distance
+    uint16_t pins;                 // Neighbors being meshed, can't unload
+    glm::vec3 bounds_min;          // World space, of the uploaded meshes
+    glm::vec3 bounds_max;
+    uint8_t face_connections[6];   // Faces seen through each face, see slice_face_connections
+    uint32_t visibility_search;    // Last visibility search which reached the slice
+    std::vector<Occluder_t> occluders; // Of the uploaded opaque mesh
+    std::vector<Block_t> table;
+    uint16_t blocks[4096];
+} Slice_t;
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+
+// Occluders rasterized on the CPU, depth in normalized device coordinates
+typedef struct OcclusionBuffer
+{
+    glm::mat4 view_projection;
+    std::vector<float> depth; // Row 0 at the bottom
+} OcclusionBuffer_t;
+
+// Slice reached by the visibility search through its entry face, directions
+// has a bit per face the search went through since the camera slice
+typedef struct VisibilityStep
+{
+    Slice_t *slice;
+    uint8_t entry;
+    uint8_t directions;
+} VisibilityStep_t;
+
+// Cheap stand-in for far away chunks: the column surfaces only, straight from
+// the heightmap, without caves nor decoration
+typedef struct ChunkSummary
 {
     int64_t x;
     int64_t y;
-    Chunk_t *chunks[16 * 16];
-} Section_t;
+    std::atomic<bool> busy; // Queued or generating
+    int32_t heights[16 * 16];
+    BlockId_t top_blocks[16 * 16];
+    uint8_t tints[16 * 16][3];
+} ChunkSummary_t;
+
+template <typename T>
+using SliceMap = std::unordered_map<SliceKey_t, T, SliceKeyHash>;
+
+// Block written by a neighbor slice decoration, in slice local coordinates
+typedef struct PendingBlock
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t z;
+    Block_t block;
+} PendingBlock_t;
 
 typedef struct Player
 {
@@ -104,14 +362,83 @@ typedef struct Player
     glm::vec3 acceleration;
 } Player_t;
 
+typedef struct GenerationJob
+{
+    Slice_t *slice;
+    SliceStatus stage;
+    MeshSettings_t mesh_settings; // Mesh stage only
+} GenerationJob_t;
+
+typedef struct CompletedMesh
+{
+    Slice_t *slice;
+    MeshSettings_t mesh_settings;
+    uint32_t faces_count;
+    uint8_t face_connections[6];
+    std::vector<Occluder_t> occluders;
+} CompletedMesh_t;
+
+typedef struct GenerationScheduler
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<GenerationJob_t> jobs;
+    std::deque<ChunkSummary_t *> summary_jobs; // Only run when jobs is empty
+    std::vector<uint64_t> completed_summaries; // Chunk keys, drained by the main thread
+    std::deque<CompletedMesh_t> completed_meshes; // Waiting for upload by the main thread
+    bool running = false;
+} GenerationScheduler_t;
+
 typedef struct World
 {
-    Section_t section;
-    Perlin_t heightmap;
+    // Loaded slices, and the columns they belong to keyed by chunk_key
+    SliceMap<Slice_t *> slices;
+    std::unordered_map<uint64_t, Chunk_t *> chunks;
+    int32_t load_radius = 7; // Horizontally, in slices
+    int32_t load_height = 5; // Vertically, in slices
+    int32_t lod_distances[MAX_LOD] = {3, 5}; // In slices, where each level starts
+    uint64_t seed = 0;
+    NoiseProgram_t heightmap;
+    std::string save_path = "world"; // Saved chunks directory, empty to always generate
+    // Decoration blocks spilling out of their slice, as [target][source] slice keys.
+    // Kept while either slice is loaded so that regenerating one side is idempotent
+    std::mutex pending_mutex;
+    SliceMap<SliceMap<std::vector<PendingBlock_t>>> pending_blocks;
+    GenerationScheduler_t scheduler;
+    // Block tints used by meshes, as 8 bits RGB. Uploaded to the shaders as they grow
+    std::mutex tints_mutex;
+    std::vector<uint32_t> tints;
+    std::unordered_map<uint32_t, uint16_t> tint_indices;
+    size_t uploaded_tints = 0;
+    // Vertex buffers of uploaded meshes, emptied and handed back to the meshers
+    std::mutex vertex_pool_mutex;
+    std::vector<std::vector<PackedVertex_t>> vertex_pool;
+    // Summaries of the chunks within summary_radius, keyed by chunk_key
+    std::unordered_map<uint64_t, ChunkSummary_t *> summaries;
+    int32_t summary_radius = 32;
+    bool summaries_loaded = false;
+    int64_t summaries_center_x;
+    int64_t summaries_center_y;
     Camera_t *main_camera = nullptr;
     Player_t *player;
 } World_t;
 
+typedef struct MapColor
+{
+    glm::vec3 base;
+    glm::vec3 overlay; // Tinted
+    float overlay_alpha;
+} MapColor_t;
+
+// Top down map of the chunk summaries, chunks wrap around the texture
+typedef struct FarMap
+{
+    unsigned int texture = 0;
+    int32_t chunks = 0; // Texture size, in chunks
+    std::unordered_map<BlockId_t, MapColor_t> colors;
+} FarMap_t;
+
 typedef struct mContext
 {
     int fps = 0;
@@ -119,8 +446,21 @@ typedef struct mContext
     double dt = 0.;
     uint32_t target_fps = 60;
     uint32_t dc = 0;
+    size_t drawn_quads = 0;
+    size_t drawn_slices = 0;
+    size_t culled_slices = 0; // Outside the camera frustum
+    size_t hidden_slices = 0; // Behind closed slices, see find_visible_slices
+    size_t occluded_slices = 0; // Behind occluders, see remove_occluded_slices
     mInput_t input;
     mDebugContext_t debug;
+    FarMap_t map;
+    unsigned int quad_indices = 0; // Shared by the slice meshes, see create_quad_index_buffer
+    GeometryArena_t geometry;
+    BoxList_t slice_boxes; // Reused by cull_slices
+    uint32_t visibility_search = 0;
+    std::vector<VisibilityStep_t> visibility_queue;
+    OcclusionBuffer_t occlusion;
+    SliceKey_t translucent_origin = {INT64_MIN, 0, 0}; // Camera slice the translucent quads are sorted from
     World_t *world = nullptr;
 } mContext_t;
 
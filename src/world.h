@@ -9,49 +9,60 @@ constexpr size_t block_index(uint8_t x, uint8_t y, uint8_t z)
     return x + 16 * y + 256 * z;
 }
 
-constexpr size_t chunk_id(uint32_t x, uint32_t y)
+// World wide chunk identifier, from chunk coordinates (in chunks, not blocks)
+constexpr uint64_t chunk_key(int64_t x, int64_t y)
 {
-    return x + 16 * y;
+    return (uint64_t)(uint32_t)x | ((uint64_t)(uint32_t)y << 32);
 }
 
-uint16_t *get_global_block(World_t *world, int64_t x, int64_t y, int64_t z)
+// Index in Slice_t::neighbors, dx, dy and dz in [-1, 1] but not all 0
+constexpr int neighbor_index(int dx, int dy, int dz)
 {
-    if (x < 0 || y < 0 || x > 256 || y > 256 || z < 0 || z > 16 * 24)
-        return NULL;
-    Section_t *section = &world->section;
-    int64_t chunk_x = x / 16;
-    int64_t chunk_y = y / 16;
-    Chunk_t *chunk = section->chunks[chunk_id(x / 16, y / 16)];
-    if (chunk==NULL)
-        return NULL;
-    Slice_t *slice = &chunk->slices[z / 16];
-    if (slice==NULL)
-        return NULL;
-    uint8_t block_x = x - chunk->x;
-    uint8_t block_y = y - chunk->y;
-    uint8_t block_z = z - slice->z;
-    return &slice->blocks[block_index(block_x, block_y, block_z)];
+    const int index = (dx + 1) + 3 * (dy + 1) + 9 * (dz + 1);
+    return index > 13 ? index - 1 : index; // 13 is the slice itself
+}
+
+// Chunk or slice containing a block coordinate
+inline int64_t block_to_chunk(int64_t x)
+{
+    return x >= 0 ? x / 16 : (x - 15) / 16;
+}
+
+Chunk_t *find_chunk(World_t *world, int64_t chunk_x, int64_t chunk_y)
+{
+    auto chunk = world->chunks.find(chunk_key(chunk_x, chunk_y));
+    return chunk != world->chunks.end() ? chunk->second : NULL;
+}
+
+Slice_t *find_slice(World_t *world, int64_t slice_x, int64_t slice_y, int64_t slice_z)
+{
+    auto slice = world->slices.find(SliceKey_t{slice_x, slice_y, slice_z});
+    return slice != world->slices.end() ? slice->second : NULL;
+}
+
+inline SliceKey_t slice_key(const Slice_t *slice)
+{
+    return SliceKey_t{slice->x / 16, slice->y / 16, slice->z / 16};
 }
 
 Block_t *get_world_block(World_t *world, int64_t x, int64_t y, int64_t z)
 {
-    if (x < 0 || y < 0 || x > 256 || y > 256 || z < 0 || z > 16 * 24)
-        return NULL;
-    Section_t *section = &world->section;
-    if (section==NULL)
+    Slice_t *slice = find_slice(world, block_to_chunk(x), block_to_chunk(y), block_to_chunk(z));
+    if (slice == NULL || slice->status < SLICE_LIT)
         return NULL;
-    int64_t chunk_x = x / 16;
-    int64_t chunk_y = y / 16;
-    Chunk_t *chunk = section->chunks[chunk_id(x / 16, y / 16)];
-    if (chunk==NULL)
-        return NULL;
-    Slice_t *slice = &chunk->slices[z / 16];
-    if (slice==NULL)
-        return NULL;
-    uint8_t block_x = x - chunk->x;
-    uint8_t block_y = y - chunk->y;
-    uint8_t block_z = z - slice->z;
-    return &slice->table[slice->blocks[block_index(block_x, block_y, block_z)]];
+    return &slice->table[slice->blocks[block_index(x - slice->x, y - slice->y, z - slice->z)]];
+}
+
+// Palette index of block within slice, appended to the palette if missing
+uint16_t find_or_add_block(Slice_t *slice, Block_t block)
+{
+    for (size_t i = 0; i < slice->table.size(); i++)
+    {
+        if (slice->table[i].block_id == block.block_id && slice->table[i].tint == block.tint)
+            return i;
+    }
+    slice->table.push_back(block);
+    return slice->table.size() - 1;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+
+#include "generation.h"
+#include "noise_graph.h"
+#include "types.h"
+#include "world.h"
+#include "decoration.h"
+#include "storage.h"
+#include "pipeline.h"
+
+// Offline world tools, sharing the generation pipeline with the game
+//
+//   worldtool pregen --radius N [--threads T] [--bottom B] [--top T] [--world DIR]
+//
+// pregen saves every chunk column within N chunks of the origin, from slice B
+// to slice T. Columns are generated by tiles of PREGEN_TILE_SIZE columns plus a
+// one column margin which is only generated up to decoration, so memory only
+// depends on the tile size. Saved columns are skipped, an interrupted run
+// resumes where it stopped.
+
+#define PREGEN_TILE_SIZE 16
+
+typedef struct PregenOptions
+{
+    int64_t radius = -1;
+    size_t threads = 0;
+    int64_t bottom = -2; // Slices, inclusive
+    int64_t top = 8;
+    const char *world_path = "world";
+} PregenOptions_t;
+
+typedef struct PregenTile
+{
+    int64_t x; // First column, in chunks
+    int64_t y;
+} PregenTile_t;
+
+void print_usage()
+{
+    printf("usage: worldtool pregen --radius N [--threads T] [--bottom B] [--top T] [--world DIR]\n");
+    printf("  --radius  chunks around the origin to generate\n");
+    printf("  --threads generation threads, all cores by default\n");
+    printf("  --bottom  lowest slice to save (default -2)\n");
+    printf("  --top     highest slice to save (default 8)\n");
+    printf("  --world   save directory (default world)\n");
+}
+
+bool parse_pregen_options(PregenOptions_t *options, int argc, char **argv)
+{
+    for (int i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("[ERROR] Missing value for %s\n", argv[i]);
+            return false;
+        }
+        const char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--radius") == 0)
+            options->radius = atoll(value);
+        else if (strcmp(argv[i - 1], "--threads") == 0)
+            options->threads = atoll(value);
+        else if (strcmp(argv[i - 1], "--bottom") == 0)
+            options->bottom = atoll(value);
+        else if (strcmp(argv[i - 1], "--top") == 0)
+            options->top = atoll(value);
+        else if (strcmp(argv[i - 1], "--world") == 0)
+            options->world_path = value;
+        else
+        {
+            printf("[ERROR] Unknown option %s\n", argv[i - 1]);
+            return false;
+        }
+    }
+    if (options->radius < 0 || options->top < options->bottom)
+    {
+        printf("[ERROR] Invalid pregen options\n");
+        return false;
+    }
+    if (options->threads == 0)
+        options->threads = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+void format_duration(char *buffer, size_t size, double seconds)
+{
+    const long long total = (long long)seconds;
+    if (total >= 3600)
+        snprintf(buffer, size, "%lldh%02lldm", total / 3600, total / 60 % 60);
+    else
+        snprintf(buffer, size, "%lldm%02llds", total / 60, total % 60);
+}
+
+// Generates and saves the unsaved columns of tile, returns the count saved
+size_t pregen_tile(World_t *world, const PregenOptions_t *options, PregenTile_t tile)
+{
+    const int64_t min_x = tile.x, max_x = std::min(tile.x + PREGEN_TILE_SIZE - 1, options->radius);
+    const int64_t min_y = tile.y, max_y = std::min(tile.y + PREGEN_TILE_SIZE - 1, options->radius);
+    std::vector<std::pair<int64_t, int64_t>> columns;
+    for (int64_t y = min_y; y <= max_y; y++)
+    {
+        for (int64_t x = min_x; x <= max_x; x++)
+        {
+            if (!is_chunk_saved(world, x, y))
+                columns.push_back(std::make_pair(x, y));
+        }
+    }
+    if (columns.empty())
+        return 0;
+
+    // Lit slices need their neighbors decorated, hence the margin
+    for (int64_t z = options->bottom - 1; z <= options->top + 1; z++)
+    {
+        for (int64_t y = min_y - 1; y <= max_y + 1; y++)
+        {
+            for (int64_t x = min_x - 1; x <= max_x + 1; x++)
+            {
+                load_slice(world, x, y, z);
+            }
+        }
+    }
+
+    std::vector<Slice_t *> slices;
+    for (const auto &column : columns)
+    {
+        for (int64_t z = options->bottom; z <= options->top; z++)
+        {
+            Slice_t *slice = find_slice(world, column.first, column.second, z);
+            while (slice->status < SLICE_LIT)
+            {
+                schedule_generation(world);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            slices.push_back(slice);
+        }
+        save_chunk(world, column.first, column.second, slices);
+        slices.clear();
+    }
+
+    // Margin slices may still be running a stage
+    bool busy = true;
+    while (busy)
+    {
+        busy = false;
+        for (auto &entry : world->slices)
+        {
+            busy |= entry.second->busy;
+        }
+        if (busy)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    while (!world->slices.empty())
+    {
+        unload_slice(world, world->slices.begin()->second);
+    }
+    return columns.size();
+}
+
+int pregen(int argc, char **argv)
+{
+    PregenOptions_t options;
+    if (!parse_pregen_options(&options, argc, argv))
+    {
+        print_usage();
+        return 1;
+    }
+
+    World_t *world = new World_t();
+    init_world(world);
+    world->save_path = options.world_path;
+    std::error_code error;
+    std::filesystem::create_directories(world->save_path, error);
+    if (error)
+    {
+        printf("[ERROR] Failed to create %s\n", options.world_path);
+        return 1;
+    }
+
+    // Closest tiles first, so that an interrupted run leaves a square around the origin
+    std::vector<PregenTile_t> tiles;
+    for (int64_t y = -options.radius; y <= options.radius; y += PREGEN_TILE_SIZE)
+    {
+        for (int64_t x = -options.radius; x <= options.radius; x += PREGEN_TILE_SIZE)
+        {
+            tiles.push_back(PregenTile_t{x, y});
+        }
+    }
+    std::stable_sort(tiles.begin(), tiles.end(), [](const PregenTile_t &a, const PregenTile_t &b)
+                     { return std::max(std::abs(2 * a.x + PREGEN_TILE_SIZE), std::abs(2 * a.y + PREGEN_TILE_SIZE)) <
+                              std::max(std::abs(2 * b.x + PREGEN_TILE_SIZE), std::abs(2 * b.y + PREGEN_TILE_SIZE)); });
+
+    const size_t total = (2 * options.radius + 1) * (2 * options.radius + 1);
+    printf("Pregenerating %zu chunks (slices %lli to %lli) in %s with %zu threads\n",
+           total, (long long)options.bottom, (long long)options.top, options.world_path, options.threads);
+    start_generation(world, options.threads);
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t done = 0;
+    size_t generated = 0;
+    for (const PregenTile_t &tile : tiles)
+    {
+        const int64_t width = std::min<int64_t>(PREGEN_TILE_SIZE, options.radius - tile.x + 1);
+        const int64_t height = std::min<int64_t>(PREGEN_TILE_SIZE, options.radius - tile.y + 1);
+        const size_t tile_generated = pregen_tile(world, &options, tile);
+        generated += tile_generated;
+        done += width * height;
+        if (tile_generated == 0)
+            continue;
+
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double rate = generated / std::max(elapsed, 1e-6);
+        char eta[32];
+        format_duration(eta, sizeof(eta), (total - done) / rate);
+        printf("%zu/%zu chunks, %.1f chunks/s, ETA %s\n", done, total, rate, eta);
+    }
+    stop_generation(world);
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    char duration[32];
+    format_duration(duration, sizeof(duration), elapsed);
+    printf("Generated %zu chunks in %s (%zu already saved)\n", generated, duration, total - generated);
+    delete world;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "pregen") == 0)
+        return pregen(argc, argv);
+    print_usage();
+    return 1;
+}
@@ -13,12 +13,19 @@ target("glad")
 
 target("minecraft")
     set_kind("binary")
-    add_files("src/*.cpp")
+    add_files("src/main.cpp")
     add_deps("glad")
     add_packages("glfw", "imgui", "glm")
     set_configdir("$(buildir)/$(plat)/$(arch)/$(mode)/resources")
     add_configfiles("resources/*", {onlycopy = true})
 
+target("worldtool")
+    set_kind("binary")
+    add_files("src/worldtool.cpp")
+    add_packages("glm")
+    set_configdir("$(buildir)/$(plat)/$(arch)/$(mode)/resources")
+    add_configfiles("resources/*", {onlycopy = true})
+
 --
 -- If you want to known more usage about xmake, please see https://xmake.io
 --